@@ -0,0 +1,276 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+
+#include "generator.h"
+
+// Elements of the buffer of each call, and of the scratch space
+static const unsigned CallElems = 4;
+static const unsigned ScratchElems = 64;
+// MPI_INT in MPICH
+static const unsigned MPIIntType = 1275069445;
+
+static cl::OptionCategory GeneratorCategory("Generator options");
+
+static cl::opt<unsigned> NumFunctions(
+    "functions", cl::desc("Number of functions"),
+    cl::init(1), cl::cat(GeneratorCategory));
+
+static cl::opt<unsigned> NumCalls(
+    "calls", cl::desc("Nonblocking calls per function"),
+    cl::init(4), cl::cat(GeneratorCategory));
+
+static cl::opt<unsigned> PendingCalls(
+    "pending", cl::desc("Calls issued before waiting for any of them"),
+    cl::init(1), cl::cat(GeneratorCategory));
+
+static cl::opt<unsigned> NumBlocks(
+    "blocks", cl::desc("Blocks between a group of calls and their waits"),
+    cl::init(16), cl::cat(GeneratorCategory));
+
+static cl::opt<CFGShape> Shape(
+    "shape", cl::desc("Control flow between the calls and their waits"),
+    cl::values(clEnumValN(ChainShape, "chain", "Forward branches"),
+               clEnumValN(LoopShape, "loops", "Nested loops"),
+               clEnumValN(SwitchShape, "switch", "Wide switches")),
+    cl::init(ChainShape), cl::cat(GeneratorCategory));
+
+static cl::opt<unsigned> LoopDepth(
+    "depth", cl::desc("Depth of the loop nests (with -shape=loops)"),
+    cl::init(3), cl::cat(GeneratorCategory));
+
+static cl::opt<unsigned> SwitchWidth(
+    "width", cl::desc("Cases of each switch (with -shape=switch)"),
+    cl::init(8), cl::cat(GeneratorCategory));
+
+static cl::opt<unsigned> NumWaits(
+    "waits", cl::desc("Alternative wait calls for each request"),
+    cl::init(1), cl::cat(GeneratorCategory));
+
+static cl::opt<AliasPattern> Aliasing(
+    "aliasing", cl::desc("Accesses to the buffers in flight"),
+    cl::values(clEnumValN(DisjointBuffers, "disjoint", "None"),
+               clEnumValN(OverlappingBuffers, "overlap", "Direct"),
+               clEnumValN(AliasedBuffers, "alias", "Through aliases")),
+    cl::init(OverlappingBuffers), cl::cat(GeneratorCategory));
+
+static cl::opt<unsigned> Seed(
+    "seed", cl::desc("Random seed"),
+    cl::init(1), cl::cat(GeneratorCategory));
+
+GeneratorOptions getGeneratorOptions(void) {
+    GeneratorOptions Opts;
+    Opts.NumFunctions = NumFunctions;
+    Opts.NumCalls = NumCalls;
+    Opts.PendingCalls = PendingCalls ? PendingCalls : 1;
+    Opts.NumBlocks = NumBlocks;
+    Opts.Shape = Shape;
+    Opts.LoopDepth = LoopDepth;
+    Opts.SwitchWidth = SwitchWidth ? SwitchWidth : 1;
+    Opts.NumWaits = NumWaits ? NumWaits : 1;
+    Opts.Aliasing = Aliasing;
+    Opts.Seed = Seed;
+    return Opts;
+}
+
+MPIProgramGenerator::MPIProgramGenerator(const GeneratorOptions &Opts_,
+                                         LLVMContext &Ctx_)
+    : Opts(Opts_), Ctx(Ctx_), M(NULL), B(Ctx_), Rng(Opts_.Seed) {
+    Int32Ty = Type::getInt32Ty(Ctx);
+    Int8PtrTy = Type::getInt8PtrTy(Ctx);
+    BufTy = ArrayType::get(Int32Ty, Opts.NumCalls * CallElems + ScratchElems);
+}
+
+BasicBlock *MPIProgramGenerator::createBlock(const Twine &Name) {
+    return BasicBlock::Create(Ctx, Name, F);
+}
+
+/// Load or store an element of the buffer, either in the scratch space or,
+/// depending on the aliasing pattern, in the buffer of a pending call
+void MPIProgramGenerator::emitAccess(void) {
+    bool InFlight = Opts.Aliasing != DisjointBuffers && random(4) == 0;
+    Value *Ptr;
+    if (InFlight && Opts.Aliasing == AliasedBuffers) {
+        Ptr = B.CreateLoad(Int32Ty->getPointerTo(), Alias);
+    } else {
+        unsigned Idx;
+        if (InFlight) {
+            unsigned Call = FirstCall + random(LastCall - FirstCall);
+            Idx = Call * CallElems + random(CallElems);
+        } else
+            Idx = Opts.NumCalls * CallElems + random(ScratchElems);
+        Ptr = B.CreateConstInBoundsGEP2_64(BufTy, Buf, 0, Idx);
+    }
+    if (random(2))
+        B.CreateStore(B.getInt32(random(100)), Ptr);
+    else
+        B.CreateLoad(Int32Ty, Ptr);
+}
+
+/// Blocks in sequence, some of them skipped by a conditional branch
+void MPIProgramGenerator::emitChain(unsigned Blocks) {
+    if (Blocks == 0)
+        return;
+    vector<BasicBlock *> BBs;
+    for (unsigned i = 0; i < Blocks; ++i)
+        BBs.push_back(createBlock("bb"));
+    BasicBlock *Join = createBlock("join");
+    B.CreateBr(BBs[0]);
+    for (unsigned i = 0; i < Blocks; ++i) {
+        B.SetInsertPoint(BBs[i]);
+        emitAccess();
+        BasicBlock *Next = i + 1 < Blocks ? BBs[i + 1] : Join;
+        BasicBlock *Skip = i + 2 < Blocks ? BBs[i + 2] : Join;
+        if (Next != Skip && random(2))
+            B.CreateCondBr(B.CreateICmpSLT(N, B.getInt32(i)), Next, Skip);
+        else
+            B.CreateBr(Next);
+    }
+    B.SetInsertPoint(Join);
+}
+
+/// A loop nest. Each level takes a header and a latch block, and the
+/// innermost body is a chain of the remaining blocks.
+void MPIProgramGenerator::emitLoop(unsigned Depth, unsigned Blocks) {
+    if (Depth == 0 || Blocks < 3) {
+        emitChain(Blocks);
+        return;
+    }
+    BasicBlock *Preheader = B.GetInsertBlock();
+    BasicBlock *Header = createBlock("loop");
+    BasicBlock *Body = createBlock("body");
+    BasicBlock *Exit = createBlock("exit");
+    B.CreateBr(Header);
+
+    B.SetInsertPoint(Header);
+    PHINode *IV = B.CreatePHI(Int32Ty, 2, "i");
+    IV->addIncoming(B.getInt32(0), Preheader);
+    emitAccess();
+    B.CreateCondBr(B.CreateICmpSLT(IV, N), Body, Exit);
+
+    B.SetInsertPoint(Body);
+    emitLoop(Depth - 1, Blocks - 2);
+    Value *Next = B.CreateAdd(IV, B.getInt32(1));
+    IV->addIncoming(Next, B.GetInsertBlock());
+    B.CreateBr(Header);
+
+    B.SetInsertPoint(Exit);
+}
+
+/// Switches of SwitchWidth cases one after another
+void MPIProgramGenerator::emitSwitches(unsigned Blocks) {
+    while (Blocks > 0) {
+        unsigned Width = min(Opts.SwitchWidth, Blocks);
+        BasicBlock *Join = createBlock("join");
+        SwitchInst *SI = B.CreateSwitch(K, Join, Width);
+        for (unsigned i = 0; i < Width; ++i) {
+            BasicBlock *Case = createBlock("case");
+            SI->addCase(B.getInt32(i), Case);
+            B.SetInsertPoint(Case);
+            emitAccess();
+            B.CreateBr(Join);
+        }
+        Blocks -= Width;
+        B.SetInsertPoint(Join);
+    }
+}
+
+void MPIProgramGenerator::emitRegion(void) {
+    switch (Opts.Shape) {
+    case ChainShape:
+        emitChain(Opts.NumBlocks);
+        break;
+    case LoopShape:
+        emitLoop(Opts.LoopDepth, Opts.NumBlocks);
+        break;
+    case SwitchShape:
+        emitSwitches(Opts.NumBlocks);
+        break;
+    }
+}
+
+/// Wait for the requests of the current group on each of NumWaits paths
+void MPIProgramGenerator::emitWaits(void) {
+    Value *Status = ConstantPointerNull::get(cast<PointerType>(Int8PtrTy));
+    BasicBlock *Join = NULL;
+    SwitchInst *SI = NULL;
+    if (Opts.NumWaits > 1) {
+        Join = createBlock("waited");
+        SI = B.CreateSwitch(K, Join, Opts.NumWaits - 1);
+    }
+    for (unsigned w = 0; w < Opts.NumWaits; ++w) {
+        if (SI) {
+            BasicBlock *WaitBB = createBlock("wait");
+            if (w == 0)
+                SI->setDefaultDest(WaitBB);
+            else
+                SI->addCase(B.getInt32(w), WaitBB);
+            B.SetInsertPoint(WaitBB);
+        }
+        for (unsigned c = FirstCall; c < LastCall; ++c) {
+            Value *Req = B.CreateConstInBoundsGEP2_64(
+                ArrayType::get(Int32Ty, Opts.NumCalls), Reqs, 0, c);
+            B.CreateCall(Wait, {Req, Status});
+        }
+        if (SI)
+            B.CreateBr(Join);
+    }
+    if (Join)
+        B.SetInsertPoint(Join);
+}
+
+void MPIProgramGenerator::emitFunction(unsigned Idx) {
+    FunctionType *FTy =
+        FunctionType::get(Type::getVoidTy(Ctx), {Int32Ty, Int32Ty}, false);
+    F = Function::Create(FTy, GlobalValue::ExternalLinkage,
+                         "fn" + Twine(Idx), M);
+    N = F->getArg(0);
+    N->setName("n");
+    K = F->getArg(1);
+    K->setName("k");
+
+    B.SetInsertPoint(createBlock("entry"));
+    Buf = B.CreateAlloca(BufTy, NULL, "buf");
+    Reqs = B.CreateAlloca(ArrayType::get(Int32Ty, Opts.NumCalls), NULL,
+                          "reqs");
+    Alias = B.CreateAlloca(Int32Ty->getPointerTo(), NULL, "alias");
+    B.CreateStore(B.CreateBitCast(Buf, Int32Ty->getPointerTo()), Alias);
+
+    for (FirstCall = 0; FirstCall < Opts.NumCalls; FirstCall = LastCall) {
+        LastCall = min(FirstCall + Opts.PendingCalls, Opts.NumCalls);
+        for (unsigned c = FirstCall; c < LastCall; ++c) {
+            Value *Elem = B.CreateConstInBoundsGEP2_64(BufTy, Buf, 0,
+                                                       c * CallElems);
+            Value *Req = B.CreateConstInBoundsGEP2_64(
+                ArrayType::get(Int32Ty, Opts.NumCalls), Reqs, 0, c);
+            B.CreateCall(random(2) ? Isend : Irecv,
+                         {B.CreateBitCast(Elem, Int8PtrTy),
+                          B.getInt32(CallElems), B.getInt32(MPIIntType),
+                          B.getInt32(0), B.getInt32(0), B.getInt32(0), Req});
+        }
+        emitRegion();
+        emitWaits();
+    }
+    B.CreateRetVoid();
+}
+
+unique_ptr<Module> MPIProgramGenerator::generate(StringRef Name) {
+    unique_ptr<Module> Mod(new Module(Name, Ctx));
+    M = Mod.get();
+    Rng.seed(Opts.Seed);
+
+    Type *Int32PtrTy = Int32Ty->getPointerTo();
+    FunctionType *NBTy = FunctionType::get(
+        Int32Ty, {Int8PtrTy, Int32Ty, Int32Ty, Int32Ty, Int32Ty, Int32Ty,
+                  Int32PtrTy}, false);
+    Isend = M->getOrInsertFunction("MPI_Isend", NBTy);
+    Irecv = M->getOrInsertFunction("MPI_Irecv", NBTy);
+    Wait = M->getOrInsertFunction(
+        "MPI_Wait", FunctionType::get(Int32Ty, {Int32PtrTy, Int8PtrTy},
+                                      false));
+
+    for (unsigned i = 0; i < Opts.NumFunctions; ++i)
+        emitFunction(i);
+    M = NULL;
+    return Mod;
+}
@@ -0,0 +1,105 @@
+#ifndef _GENERATOR_H_
+#define _GENERATOR_H_
+
+#include <memory>
+#include <random>
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+using namespace std;
+
+// Control flow between the nonblocking calls and their wait calls
+enum CFGShape {
+    ChainShape,     // blocks skipping ahead on conditional branches
+    LoopShape,      // nested loops
+    SwitchShape     // consecutive wide switches
+};
+
+// How the memory accesses relate to the buffers of the calls
+enum AliasPattern {
+    DisjointBuffers,    // never touch a buffer in flight
+    OverlappingBuffers, // sometimes touch a buffer in flight
+    AliasedBuffers      // sometimes touch it through a stored pointer
+};
+
+struct GeneratorOptions {
+    unsigned NumFunctions;
+    // Nonblocking calls per function
+    unsigned NumCalls;
+    // Calls issued before waiting for any of them
+    unsigned PendingCalls;
+    // Blocks between a group of calls and their wait calls
+    unsigned NumBlocks;
+    CFGShape Shape;
+    unsigned LoopDepth;
+    unsigned SwitchWidth;
+    // Alternative wait calls for each request, on different paths
+    unsigned NumWaits;
+    AliasPattern Aliasing;
+    unsigned Seed;
+};
+
+/// Options set on the command line of the tools
+GeneratorOptions getGeneratorOptions(void);
+
+/// Build a synthetic MPI program. Each function allocates one buffer
+/// holding the buffers of all its calls followed by scratch space, and
+/// issues its calls in groups of PendingCalls. After each group, a
+/// region of NumBlocks blocks of the given shape accesses the buffer,
+/// and then every request of the group is waited for, on NumWaits
+/// alternative paths. The same options and seed give the same program.
+class MPIProgramGenerator {
+private:
+    const GeneratorOptions &Opts;
+    LLVMContext &Ctx;
+    Module *M;
+    IRBuilder<> B;
+    mt19937 Rng;
+
+    Type *Int32Ty;
+    Type *Int8PtrTy;
+    ArrayType *BufTy;
+    FunctionCallee Isend, Irecv, Wait;
+
+    // State of the function being generated
+    Function *F;
+    Value *Buf;
+    // Slot holding a pointer to the buffer
+    Value *Alias;
+    Value *Reqs;
+    Value *N;
+    Value *K;
+    // Calls of the current group
+    unsigned FirstCall;
+    unsigned LastCall;
+
+    unsigned random(unsigned Bound) {
+        return Bound ? Rng() % Bound : 0;
+    }
+
+    BasicBlock *createBlock(const Twine &Name);
+
+    void emitAccess(void);
+
+    void emitChain(unsigned Blocks);
+
+    void emitLoop(unsigned Depth, unsigned Blocks);
+
+    void emitSwitches(unsigned Blocks);
+
+    void emitRegion(void);
+
+    void emitWaits(void);
+
+    void emitFunction(unsigned);
+
+public:
+    MPIProgramGenerator(const GeneratorOptions &, LLVMContext &);
+
+    unique_ptr<Module> generate(StringRef Name);
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include <chrono>
+#include <cmath>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+
+#include "generator.h"
+
+cl::opt<std::string> AnalyzerPath(
+    "mpirace", cl::desc("Analyzer to run (default: next to this tool)"),
+    cl::value_desc("path"), cl::init(""));
+
+cl::opt<std::string> SweepParam(
+    "sweep",
+    cl::desc("Generator option to vary: functions, calls, pending, "
+             "blocks, depth, width or waits"),
+    cl::init("blocks"));
+
+cl::list<unsigned> SweepValues(
+    "values", cl::desc("Values of the swept option"), cl::CommaSeparated);
+
+cl::opt<unsigned> NumRuns(
+    "runs", cl::desc("Runs per value, the fastest is reported"),
+    cl::init(1));
+
+cl::list<std::string> AnalyzerArgs(
+    "analyzer-arg", cl::desc("Extra argument for the analyzer"),
+    cl::value_desc("arg"));
+
+cl::opt<bool> KeepFiles(
+    "keep", cl::desc("Keep the generated bitcode and analyzer output"),
+    cl::init(false));
+
+struct BenchResult {
+    unsigned Value;
+    uint64_t NumBlocks;
+    double WallTime;
+    double UserTime;
+    uint64_t PeakMemory;
+    uint64_t NumCalls;
+    uint64_t NumVisited;
+};
+
+static bool setParameter(GeneratorOptions &Opts, StringRef Name,
+                         unsigned Value) {
+    if (Name == "functions")
+        Opts.NumFunctions = Value;
+    else if (Name == "calls")
+        Opts.NumCalls = Value;
+    else if (Name == "pending")
+        Opts.PendingCalls = Value ? Value : 1;
+    else if (Name == "blocks")
+        Opts.NumBlocks = Value;
+    else if (Name == "depth")
+        Opts.LoopDepth = Value;
+    else if (Name == "width")
+        Opts.SwitchWidth = Value ? Value : 1;
+    else if (Name == "waits")
+        Opts.NumWaits = Value ? Value : 1;
+    else
+        return false;
+    return true;
+}
+
+/// Read the statistics the analyzer prints with -verbose-level=1
+static void parseStatistics(StringRef Output, BenchResult &R) {
+    R.NumCalls = 0;
+    R.NumVisited = 0;
+    SmallVector<StringRef, 64> Lines;
+    Output.split(Lines, '\n');
+    for (StringRef Line : Lines) {
+        if (!Line.consume_front("== Visited "))
+            continue;
+        StringRef Visited = Line.substr(0, Line.find(' '));
+        Line = Line.drop_front(Visited.size());
+        if (!Line.consume_front(" blocks from "))
+            continue;
+        StringRef Calls = Line.substr(0, Line.find(' '));
+        Visited.getAsInteger(10, R.NumVisited);
+        Calls.getAsInteger(10, R.NumCalls);
+    }
+}
+
+/// Generate the program for one value of the swept option and analyze it
+/// NumRuns times in a fresh process, keeping the fastest run
+static bool runBenchmark(StringRef Analyzer, GeneratorOptions &Opts,
+                         BenchResult &R) {
+    LLVMContext Ctx;
+    MPIProgramGenerator Gen(Opts, Ctx);
+    unique_ptr<Module> M = Gen.generate("bench");
+    R.NumBlocks = 0;
+    for (Function &F : *M)
+        R.NumBlocks += F.size();
+
+    SmallString<128> InputFile, OutputFile;
+    int FD;
+    if (error_code EC = sys::fs::createTemporaryFile("mpibench", "bc", FD,
+                                                     InputFile)) {
+        errs() << "cannot create a temporary file: " << EC.message() << "\n";
+        return false;
+    }
+    {
+        raw_fd_ostream OS(FD, true);
+        WriteBitcodeToFile(*M, OS);
+    }
+    sys::fs::createTemporaryFile("mpibench", "out", OutputFile);
+
+    vector<StringRef> Args;
+    Args.push_back(Analyzer);
+    Args.push_back("-race");
+    Args.push_back("-verbose-level=1");
+    for (const string &Arg : AnalyzerArgs)
+        Args.push_back(Arg);
+    Args.push_back(InputFile);
+    Optional<StringRef> Redirects[] = {None, StringRef(OutputFile),
+                                       StringRef(OutputFile)};
+
+    bool Ok = true;
+    for (unsigned Run = 0; Run < max(1U, (unsigned)NumRuns); ++Run) {
+        string ErrMsg;
+        Optional<sys::ProcessStatistics> Stats;
+        auto Start = chrono::steady_clock::now();
+        int RC = sys::ExecuteAndWait(Analyzer, Args, None, Redirects, 0, 0,
+                                     &ErrMsg, NULL, &Stats);
+        double Wall = chrono::duration<double>(
+            chrono::steady_clock::now() - Start).count();
+        if (RC != 0 || !Stats) {
+            errs() << Analyzer << " failed on " << InputFile << " ("
+                   << (ErrMsg.empty() ? "exit code " + to_string(RC) : ErrMsg)
+                   << ")\n";
+            Ok = false;
+            break;
+        }
+        if (Run == 0 || Wall < R.WallTime) {
+            R.WallTime = Wall;
+            R.UserTime = Stats->UserTime.count() / 1e6;
+            R.PeakMemory = Stats->PeakMemory << 10;
+        }
+    }
+
+    if (Ok) {
+        ErrorOr<unique_ptr<MemoryBuffer>> Output =
+            MemoryBuffer::getFile(OutputFile);
+        if (Output)
+            parseStatistics((*Output)->getBuffer(), R);
+    }
+    if (KeepFiles && Ok) {
+        errs() << "== " << SweepParam << "=" << R.Value << ": " << InputFile
+               << " " << OutputFile << "\n";
+    } else {
+        sys::fs::remove(InputFile);
+        sys::fs::remove(OutputFile);
+    }
+    return Ok;
+}
+
+/// Growth of a measure relative to the growth of the program between two
+/// values: 1 is linear, 2 quadratic
+static double getExponent(double Prev, double Cur, uint64_t PrevSize,
+                          uint64_t CurSize) {
+    if (Prev <= 0 || Cur <= 0 || PrevSize == CurSize)
+        return 0;
+    return log(Cur / Prev) / log((double)CurSize / PrevSize);
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, argv,
+                                "Scaling benchmark of the race detector\n");
+
+    string Analyzer = AnalyzerPath;
+    if (Analyzer.empty()) {
+        SmallString<128> Path(sys::fs::getMainExecutable(
+            argv[0], (void *)(intptr_t)&main));
+        sys::path::remove_filename(Path);
+        sys::path::append(Path, "mpirace");
+        Analyzer = Path.str().str();
+    }
+
+    GeneratorOptions Opts = getGeneratorOptions();
+    vector<unsigned> Values(SweepValues.begin(), SweepValues.end());
+    if (Values.empty())
+        Values = {16, 32, 64, 128, 256, 512};
+    if (!setParameter(Opts, SweepParam, Values[0])) {
+        errs() << argv[0] << ": unknown option to sweep: " << SweepParam
+               << "\n";
+        return 1;
+    }
+
+    outs() << right_justify(SweepParam, 10)
+           << "   total-bb   wall(s)   user(s)   rss(MB)    calls"
+              "      visited   per-call  t-exp  v-exp\n";
+    vector<BenchResult> Results;
+    for (unsigned Value : Values) {
+        BenchResult R;
+        R.Value = Value;
+        setParameter(Opts, SweepParam, Value);
+        if (!runBenchmark(Analyzer, Opts, R))
+            return 1;
+
+        double TimeExp = 0, VisitExp = 0;
+        if (!Results.empty()) {
+            BenchResult &Prev = Results.back();
+            TimeExp = getExponent(Prev.UserTime, R.UserTime, Prev.NumBlocks,
+                                  R.NumBlocks);
+            VisitExp = getExponent(Prev.NumVisited, R.NumVisited,
+                                   Prev.NumBlocks, R.NumBlocks);
+        }
+        outs() << format("%10u %10llu %9.3f %9.3f %9llu %8llu %12llu "
+                         "%10.1f %6.2f %6.2f\n",
+                         Value, (unsigned long long)R.NumBlocks, R.WallTime,
+                         R.UserTime,
+                         (unsigned long long)(R.PeakMemory >> 20),
+                         (unsigned long long)R.NumCalls,
+                         (unsigned long long)R.NumVisited,
+                         R.NumCalls ? (double)R.NumVisited / R.NumCalls : 0.0,
+                         TimeExp, VisitExp);
+        outs().flush();
+        Results.push_back(R);
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ToolOutputFile.h"
+
+#include "generator.h"
+
+cl::opt<std::string> OutputFilename(
+    "o", cl::desc("Output bitcode file"), cl::value_desc("file"),
+    cl::Required);
+
+cl::opt<bool> EmitAssembly(
+    "S", cl::desc("Write textual IR instead of bitcode"), cl::init(false));
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, argv,
+                                "Synthetic MPI program generator\n");
+
+    LLVMContext Ctx;
+    GeneratorOptions Opts = getGeneratorOptions();
+    MPIProgramGenerator Gen(Opts, Ctx);
+    unique_ptr<Module> M = Gen.generate(OutputFilename);
+    if (verifyModule(*M, &errs()))
+        return 1;
+
+    error_code EC;
+    ToolOutputFile Out(OutputFilename, EC,
+                       EmitAssembly ? sys::fs::OF_Text : sys::fs::OF_None);
+    if (EC) {
+        errs() << argv[0] << ": cannot open '" << OutputFilename << "': "
+               << EC.message() << "\n";
+        return 1;
+    }
+    if (EmitAssembly)
+        M->print(Out.os(), NULL);
+    else
+        WriteBitcodeToFile(*M, Out.os());
+    Out.keep();
+    return 0;
+}
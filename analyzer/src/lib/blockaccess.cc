@@ -0,0 +1,179 @@
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+
+#include "blockaccess.h"
+#include "mpirace.h"
+
+/// One pass over the instructions of the function. Each base is resolved
+/// to its roots when it is first seen, with the diagnostics of the
+/// resolver held back: they are printed when the overlap index resolves
+/// the base again.
+BlockAccessTable::BlockAccessTable(FunctionContext *FCtx)
+    : RootPointers(FCtx->RootPointers) {
+    ReachabilityIndex *RC = FCtx->Reachability;
+    // Own copy of the layout, as functions are analyzed in parallel
+    DataLayout DL(FCtx->CurrentFunc->getParent()->getDataLayout());
+    unsigned NumBlocks = RC->getNumBlocks();
+    BlockRows.reserve(NumBlocks + 1);
+    BlockFilters.assign(NumBlocks, 0);
+    BlockCalls.assign(NumBlocks, false);
+
+    for (unsigned b = 0; b < NumBlocks; ++b) {
+        BasicBlock *BB = RC->getBlock(b);
+        BlockRows.push_back(Insts.size());
+        unsigned Pos = 0;
+        for (BasicBlock::iterator it = BB->begin(), ie = BB->end();
+             it != ie; ++it, ++Pos) {
+            Instruction *I = &*it;
+            if (CallBase *CI = dyn_cast<CallBase>(I)) {
+                if (!FCtx->getNonblockingCall(CI) &&
+                    !FCtx->getBlockingCall(CI) && !FCtx->getCalleeSummary(CI))
+                    continue;
+                Insts.push_back(I);
+                Positions.push_back(Pos);
+                BaseIds.push_back(NoId);
+                RootIds.push_back(NoRoot);
+                Offsets.push_back(0);
+                Sizes.push_back(0);
+                Flags.push_back(CallFlag);
+                BlockCalls[b] = true;
+                continue;
+            }
+            if (!isa<LoadInst>(I) && !isa<StoreInst>(I))
+                continue;
+
+            Value *Ptr;
+            uint64_t Size;
+            bool IsWrite;
+            string SizeError;
+            {
+                raw_string_ostream OS(SizeError);
+                raw_ostream *PrevOS = setOutputStream(&OS);
+                FCtx->getBufferAccess(I, Ptr, Size, IsWrite);
+                OS.flush();
+                setOutputStream(PrevOS);
+            }
+            BufferAccess A;
+            BufferOverlapIndex::getLocation(Ptr, DL, A);
+            unsigned BaseId = intern(A.Base);
+            unsigned RootId = getRootId(A.Base, BaseId);
+            if (!SizeError.empty()) {
+                SizeErrors[Insts.size()] = SizeError;
+                RootId = AnyRoot;
+            }
+
+            Insts.push_back(I);
+            Positions.push_back(Pos);
+            BaseIds.push_back(BaseId);
+            RootIds.push_back(RootId);
+            Offsets.push_back(A.Offset);
+            Sizes.push_back(Size);
+            Flags.push_back((IsWrite ? WriteFlag : 0) |
+                            (A.IsElement ? ElementFlag : 0));
+
+            uint64_t &Filter = BlockFilters[b];
+            Filter |= getIdBit(BaseId);
+            if (RootId == AnyRoot)
+                Filter = ~0ULL;
+            else if (RootId != NoRoot)
+                Filter |= getIdBit(RootId);
+        }
+    }
+    BlockRows.push_back(Insts.size());
+}
+
+unsigned BlockAccessTable::intern(Value *V) {
+    pair<DenseMap<Value *, unsigned>::iterator, bool> Ins =
+        Ids.insert(make_pair(V, (unsigned)Values.size()));
+    if (Ins.second)
+        Values.push_back(V);
+    return Ins.first->second;
+}
+
+/// Root id of a base: the id of its only root, NoRoot if it has none, and
+/// AnyRoot if it has several or its resolution prints diagnostics. Null
+/// roots are left out, as the overlap index never matches them.
+unsigned BlockAccessTable::getRootId(Value *Base, unsigned BaseId) {
+    DenseMap<unsigned, unsigned>::iterator it = BaseRoots.find(BaseId);
+    if (it != BaseRoots.end())
+        return it->second;
+
+    set<Value *> Roots;
+    string Diagnostics;
+    {
+        raw_string_ostream OS(Diagnostics);
+        raw_ostream *PrevOS = setOutputStream(&OS);
+        RootPointers->collectRootPointers(Base, Roots);
+        OS.flush();
+        setOutputStream(PrevOS);
+    }
+
+    unsigned RootId = Diagnostics.empty() ? NoRoot : AnyRoot;
+    for (set<Value *>::iterator rt = Roots.begin(), re = Roots.end();
+         rt != re && RootId != AnyRoot; ++rt) {
+        if (isa<ConstantPointerNull>(*rt))
+            continue;
+        RootId = RootId == NoRoot ? intern(*rt) : AnyRoot;
+    }
+    BaseRoots[BaseId] = RootId;
+    return RootId;
+}
+
+void BlockAccessTable::getQuery(const BufferAccess &Buffer,
+                                AccessQuery &Q) {
+    Q.BaseId = NoId;
+    Q.RootIds.clear();
+    Q.Filter = 0;
+    DenseMap<Value *, unsigned>::iterator it = Ids.find(Buffer.Base);
+    if (it != Ids.end()) {
+        Q.BaseId = it->second;
+        Q.Filter |= getIdBit(Q.BaseId);
+    }
+
+    // The diagnostics are printed when the buffer is checked for overlaps
+    set<Value *> Roots;
+    raw_null_ostream NullOS;
+    raw_ostream *PrevOS = setOutputStream(&NullOS);
+    RootPointers->collectRootPointers(Buffer.Base, Roots);
+    setOutputStream(PrevOS);
+    for (set<Value *>::iterator rt = Roots.begin(), re = Roots.end();
+         rt != re; ++rt) {
+        if (isa<ConstantPointerNull>(*rt))
+            continue;
+        it = Ids.find(*rt);
+        if (it == Ids.end())
+            continue;
+        Q.RootIds.push_back(it->second);
+        Q.Filter |= getIdBit(it->second);
+    }
+}
+
+void BlockAccessTable::matchRows(unsigned Begin, unsigned End,
+                                 const AccessQuery &Q,
+                                 SmallVectorImpl<uint8_t> &Match) {
+    unsigned N = End - Begin;
+    Match.resize(N);
+    uint8_t *M = Match.data();
+    const unsigned *Bases = BaseIds.data() + Begin;
+    const unsigned *Roots = RootIds.data() + Begin;
+    unsigned BaseId = Q.BaseId;
+    for (unsigned i = 0; i < N; ++i)
+        M[i] = (Bases[i] == BaseId) | (Roots[i] == AnyRoot);
+    for (unsigned RootId : Q.RootIds) {
+        for (unsigned i = 0; i < N; ++i)
+            M[i] |= Roots[i] == RootId;
+    }
+}
+
+void BlockAccessTable::getAccess(unsigned Row, BufferAccess &A) {
+    DenseMap<unsigned, string>::iterator it = SizeErrors.find(Row);
+    if (it != SizeErrors.end())
+        OP << it->second;
+    A.Inst = Insts[Row];
+    A.Base = Values[BaseIds[Row]];
+    A.Offset = Offsets[Row];
+    A.Size = Sizes[Row];
+    A.IsWrite = Flags[Row] & WriteFlag;
+    A.IsElement = Flags[Row] & ElementFlag;
+}
@@ -0,0 +1,136 @@
+#ifndef _BLOCKACCESS_H_
+#define _BLOCKACCESS_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+#include "bufferoverlap.h"
+#include "common.h"
+
+struct FunctionContext;
+
+/// Buffer of a nonblocking call as matched against the accesses of a
+/// block access table
+struct AccessQuery {
+    // Id of the base of the buffer, NoId if no access uses it
+    unsigned BaseId;
+    // Ids of the roots of the buffer that some access uses
+    SmallVector<unsigned, 4> RootIds;
+    // Bloom filter of the ids above
+    uint64_t Filter;
+};
+
+/// Loads and stores of a function, located once and summarized block by
+/// block as columns: the position of the instruction, the interned ids
+/// of its base and of the root of the base, the offset, the size and the
+/// flags of the access. The race window of every nonblocking call is then
+/// a scan of these columns rather than of the instructions. Each block
+/// also keeps a Bloom filter of the ids of its accesses, so that a walk
+/// skips the loads and stores of a block that cannot alias the buffer of
+/// a call. Calls that may access buffers are kept as rows to be checked
+/// against each call, since what they access depends on the call.
+class BlockAccessTable {
+public:
+    enum : unsigned {
+        NoId = ~0U,
+        // Root id of an access through a base with no root
+        NoRoot = ~0U,
+        // Root id of an access that must be checked against every
+        // buffer: its base has several roots, or printed diagnostics
+        // while it was resolved or sized, which the checks replay
+        AnyRoot = ~0U - 1,
+    };
+
+    enum : uint8_t {
+        WriteFlag = 1,
+        ElementFlag = 2,
+        CallFlag = 4,
+    };
+
+private:
+    RootPointerResolver *RootPointers;
+
+    // Columns of the rows, block by block, in program order
+    vector<Instruction *> Insts;
+    vector<unsigned> Positions;
+    vector<unsigned> BaseIds;
+    vector<unsigned> RootIds;
+    vector<int64_t> Offsets;
+    vector<uint64_t> Sizes;
+    vector<uint8_t> Flags;
+    // Diagnostics of the sizes of the accesses, by row
+    DenseMap<unsigned, string> SizeErrors;
+
+    // First row of each block by block id, and the end of the rows
+    vector<unsigned> BlockRows;
+    // Bloom filter of the base and root ids of the loads and stores of
+    // each block
+    vector<uint64_t> BlockFilters;
+    // Whether a block has calls that may access buffers
+    vector<bool> BlockCalls;
+
+    // Bases and roots, interned
+    DenseMap<Value *, unsigned> Ids;
+    vector<Value *> Values;
+    // Root id of each base id, computed when the base is first interned
+    DenseMap<unsigned, unsigned> BaseRoots;
+
+    unsigned intern(Value *);
+
+    unsigned getRootId(Value *Base, unsigned BaseId);
+
+    static uint64_t getIdBit(unsigned Id) {
+        return 1ULL << (Id & 63);
+    }
+
+public:
+    /// Summarize the blocks of the current function of a context, with
+    /// its blocks numbered by the reachability index
+    BlockAccessTable(FunctionContext *);
+
+    /// Match the buffer of a nonblocking call located at Buffer
+    void getQuery(const BufferAccess &Buffer, AccessQuery &Q);
+
+    /// Rows [Begin, End) of a block
+    void getRows(unsigned Block, unsigned &Begin, unsigned &End) {
+        Begin = BlockRows[Block];
+        End = BlockRows[Block + 1];
+    }
+
+    /// Whether some load or store of a block may alias the buffer. The
+    /// filter of a block with an AnyRoot access has every bit set.
+    bool mayMatchBlock(unsigned Block, const AccessQuery &Q) {
+        uint64_t Filter = BlockFilters[Block];
+        return (Filter & Q.Filter) || Filter == ~0ULL;
+    }
+
+    bool hasCalls(unsigned Block) {
+        return BlockCalls[Block];
+    }
+
+    /// Mark the loads and stores of rows [Begin, End) that may alias the
+    /// buffer. The id columns are compared as a whole, so that the loops
+    /// vectorize.
+    void matchRows(unsigned Begin, unsigned End, const AccessQuery &Q,
+                   SmallVectorImpl<uint8_t> &Match);
+
+    Instruction *getInst(unsigned Row) {
+        return Insts[Row];
+    }
+
+    unsigned getPosition(unsigned Row) {
+        return Positions[Row];
+    }
+
+    uint8_t getFlags(unsigned Row) {
+        return Flags[Row];
+    }
+
+    /// Get the located access of a load or store, replaying the
+    /// diagnostics of its size
+    void getAccess(unsigned Row, BufferAccess &A);
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "llvm/IR/Instructions.h"
+
+#include "budget.h"
+
+// Blocks charged between two reads of the clock, a power of two
+static const uint64_t ClockInterval = 16;
+
+AnalysisBudget::AnalysisBudget(void)
+    : Parent(NULL), MaxBlocks(0), Blocks(0), BlocksLimit(NoLimit),
+      Timed(false), EndLimit(NoLimit), Exhausted(NoLimit) {
+}
+
+void AnalysisBudget::start(const GlobalContext *Ctx,
+                           AnalysisBudget *Parent_) {
+    Parent = Parent_;
+    Blocks = 0;
+    Exhausted = NoLimit;
+    double Seconds;
+    if (Parent) {
+        MaxBlocks = Ctx->MaxCallBlocks;
+        BlocksLimit = CallBlocksLimit;
+        Seconds = Ctx->CallTimeLimit;
+        EndLimit = CallTimeLimit;
+    } else {
+        MaxBlocks = Ctx->MaxFunctionBlocks;
+        BlocksLimit = FunctionBlocksLimit;
+        Seconds = Ctx->FunctionTimeLimit;
+        EndLimit = FunctionTimeLimit;
+    }
+
+    chrono::steady_clock::time_point Now = chrono::steady_clock::now();
+    Timed = Seconds > 0;
+    if (Timed)
+        End = Now + chrono::duration_cast<chrono::steady_clock::duration>(
+                        chrono::duration<double>(Seconds));
+    // The calls see the deadline through their function
+    if (!Parent && Ctx->HasDeadline && (!Timed || Ctx->Deadline < End)) {
+        Timed = true;
+        End = Ctx->Deadline;
+        EndLimit = DeadlineLimit;
+    }
+}
+
+/// Record the limit that ran out, keeping the first one
+bool AnalysisBudget::exhaust(Limit L) {
+    unsigned Expected = NoLimit;
+    Exhausted.compare_exchange_strong(Expected, L);
+    return false;
+}
+
+bool AnalysisBudget::charge(uint64_t N) {
+    if (isExhausted())
+        return false;
+    if (!MaxBlocks && !Timed && !Parent)
+        return true;
+
+    uint64_t Total = Blocks.fetch_add(N, memory_order_relaxed) + N;
+    if (MaxBlocks && Total > MaxBlocks)
+        return exhaust(BlocksLimit);
+    if (Parent && !Parent->charge(N))
+        return exhaust(Parent->getExhaustedLimit());
+    if (Timed && (Total - N) / ClockInterval != Total / ClockInterval &&
+        chrono::steady_clock::now() >= End)
+        return exhaust(EndLimit);
+    return true;
+}
+
+const char *AnalysisBudget::getLimitName(Limit L) {
+    switch (L) {
+    case CallBlocksLimit:
+        return "block limit of the call";
+    case CallTimeLimit:
+        return "time limit of the call";
+    case FunctionBlocksLimit:
+        return "block limit of the function";
+    case FunctionTimeLimit:
+        return "time limit of the function";
+    case DeadlineLimit:
+        return "deadline of the run";
+    default:
+        return "no limit";
+    }
+}
+
+uint64_t estimateFunctionCost(Function *F, unsigned NumCalls) {
+    uint64_t NumInsts = 0;
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt)
+        NumInsts += bt->size();
+    return NumInsts * NumCalls;
+}
@@ -0,0 +1,70 @@
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+#include <atomic>
+#include <chrono>
+
+#include "llvm/IR/Function.h"
+
+#include "global.h"
+
+/// Work left for the analysis of a function or of one of its nonblocking
+/// calls, in blocks visited and in wall time. A call budget also draws on
+/// the budget of its function, and a function budget ends at the deadline
+/// of the run. Walks charge the blocks they visit and stop once a charge
+/// fails, so that a function too large for its budget yields a partial
+/// report instead of holding up the run. Charges may come from several
+/// threads when the calls of a function are analyzed as separate tasks.
+class AnalysisBudget {
+public:
+    enum Limit {
+        NoLimit = 0,
+        CallBlocksLimit,
+        CallTimeLimit,
+        FunctionBlocksLimit,
+        FunctionTimeLimit,
+        DeadlineLimit,
+    };
+
+private:
+    AnalysisBudget *Parent;
+    uint64_t MaxBlocks;
+    atomic<uint64_t> Blocks;
+    Limit BlocksLimit;
+    // End of the time of the budget, if timed, and what ends it
+    bool Timed;
+    chrono::steady_clock::time_point End;
+    Limit EndLimit;
+    // Limit that ran out first, NoLimit while work remains
+    atomic<unsigned> Exhausted;
+
+    bool exhaust(Limit);
+
+public:
+    /// An unlimited budget until started
+    AnalysisBudget(void);
+
+    /// Start the budget of a function (Parent is NULL) or of a nonblocking
+    /// call of the function with the budget Parent
+    void start(const GlobalContext *, AnalysisBudget *Parent);
+
+    /// Charge N visited blocks, false once the budget is exhausted. The
+    /// clock is only read every few blocks.
+    bool charge(uint64_t N = 1);
+
+    bool isExhausted(void) const {
+        return Exhausted.load(memory_order_relaxed) != NoLimit;
+    }
+
+    Limit getExhaustedLimit(void) const {
+        return (Limit)Exhausted.load(memory_order_relaxed);
+    }
+
+    static const char *getLimitName(Limit);
+};
+
+/// Estimated cost of analyzing a function with a number of nonblocking
+/// calls: each call may walk every instruction of the function
+uint64_t estimateFunctionCost(Function *, unsigned NumCalls);
+
+#endif
@@ -0,0 +1,152 @@
+#include "llvm/ADT/BitVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Operator.h"
+
+#include "bufferoverlap.h"
+#include "stats.h"
+
+BufferOverlapIndex::BufferOverlapIndex(RootPointerResolver *RP,
+                                       const DataLayout &Layout)
+    : RootPointers(RP), DL(Layout) {
+}
+
+/// Bytes [Start, End) covered by an access. An unknown size, e.g., the
+/// count of a call is not a constant, covers the rest of the object.
+static void getRange(const BufferAccess &A, int64_t &Start, int64_t &End) {
+    if (A.Size == UnboundedSize) {
+        Start = INT64_MIN;
+        End = INT64_MAX;
+        return;
+    }
+    Start = A.Offset;
+    End = A.Size ? A.Offset + A.Size : INT64_MAX;
+}
+
+/// Check whether an access is at a constant offset from its base, which
+/// is not derived through a variable index itself
+static bool hasConstantOffset(const BufferAccess &A) {
+    return A.Size != UnboundedSize && !isa<GEPOperator>(A.Base);
+}
+
+void BufferOverlapIndex::getLocation(Value *Ptr, const DataLayout &DL,
+                                     BufferAccess &A) {
+    APInt Offset(DL.getIndexTypeSizeInBits(Ptr->getType()), 0);
+    A.Base = Ptr->stripAndAccumulateConstantOffsets(
+        DL, Offset, /*AllowNonInbounds=*/true);
+    A.Offset = Offset.getSExtValue();
+    A.IsElement = isa<GEPOperator>(Ptr->stripPointerCasts());
+}
+
+void BufferOverlapIndex::addAccess(Instruction *I, Value *Ptr,
+                                   uint64_t Size, bool IsWrite) {
+    BufferAccess A;
+    A.Inst = I;
+    A.Size = Size;
+    A.IsWrite = IsWrite;
+    getLocation(Ptr, A);
+    addAccess(A);
+}
+
+void BufferOverlapIndex::addAccess(const BufferAccess &A) {
+    Interval IV;
+    getRange(A, IV.Start, IV.End);
+    IV.Access = Accesses.size();
+    BaseIntervals[A.Base].push_back(IV);
+    Accesses.push_back(A);
+}
+
+void BufferOverlapIndex::build(void) {
+    for (MapVector<Value *, vector<Interval>>::iterator
+           it = BaseIntervals.begin(), ie = BaseIntervals.end();
+         it != ie; ++it) {
+        vector<Interval> &IVs = it->second;
+        llvm::stable_sort(IVs, [](const Interval &A, const Interval &B) {
+            return A.Start < B.Start;
+        });
+        int64_t MaxEnd = INT64_MIN;
+        for (Interval &IV : IVs) {
+            MaxEnd = max(MaxEnd, IV.End);
+            IV.MaxEnd = MaxEnd;
+        }
+
+        set<Value *> Roots;
+        RootPointers->collectRootPointers(it->first, Roots);
+        for (set<Value *>::iterator rt = Roots.begin(), re = Roots.end();
+             rt != re; ++rt) {
+            if (isa<ConstantPointerNull>(*rt))
+                continue;
+            RootBases[*rt].push_back(it->first);
+        }
+    }
+}
+
+void BufferOverlapIndex::findOverlaps(Value *Ptr, uint64_t Size,
+                                      bool IsWrite,
+                                      SmallVectorImpl<unsigned> &Overlaps) {
+    BufferAccess Q;
+    getLocation(Ptr, Q);
+    Q.Size = Size;
+    Q.IsWrite = IsWrite;
+    findOverlaps(Q, Overlaps);
+}
+
+void BufferOverlapIndex::findOverlaps(const BufferAccess &Q,
+                                      SmallVectorImpl<unsigned> &Overlaps) {
+    BitVector Found(Accesses.size());
+    uint64_t NumChecks = 0;
+    int64_t Start, End;
+    getRange(Q, Start, End);
+
+    // Accesses through the same base overlap if their bytes intersect
+    MapVector<Value *, vector<Interval>>::iterator it =
+        BaseIntervals.find(Q.Base);
+    if (it != BaseIntervals.end()) {
+        vector<Interval> &IVs = it->second;
+        // Intervals from this one on start after the queried range
+        unsigned Idx = lower_bound(IVs.begin(), IVs.end(), End,
+                                   [](const Interval &IV, int64_t Offset) {
+                                       return IV.Start < Offset;
+                                   }) - IVs.begin();
+        while (Idx > 0 && IVs[Idx - 1].MaxEnd > Start) {
+            --Idx;
+            ++NumChecks;
+            if (IVs[Idx].End > Start)
+                Found.set(IVs[Idx].Access);
+        }
+    }
+
+    // Accesses through other bases overlap if they may point to the same
+    // object
+    set<Value *> Roots;
+    RootPointers->collectRootPointers(Q.Base, Roots);
+    for (set<Value *>::iterator rt = Roots.begin(), re = Roots.end();
+         rt != re; ++rt) {
+        DenseMap<Value *, SmallVector<Value *, 4>>::iterator bit =
+            RootBases.find(*rt);
+        if (bit == RootBases.end())
+            continue;
+        for (Value *Base : bit->second) {
+            if (Base == Q.Base)
+                continue;
+            for (Interval &IV : BaseIntervals[Base]) {
+                BufferAccess &A = Accesses[IV.Access];
+                ++NumChecks;
+                if (A.IsElement && Q.IsElement) {
+                    // e.g., &buf[1] through two loads of buf. Elements
+                    // behind a variable index cannot be compared.
+                    if (!hasConstantOffset(A) || !hasConstantOffset(Q))
+                        continue;
+                    if (IV.End <= Start || End <= IV.Start)
+                        continue;
+                }
+                Found.set(IV.Access);
+            }
+        }
+    }
+
+    for (unsigned Idx : Found.set_bits()) {
+        if (Q.IsWrite || Accesses[Idx].IsWrite)
+            Overlaps.push_back(Idx);
+    }
+    addCounter(OverlapChecksCounter, NumChecks);
+}
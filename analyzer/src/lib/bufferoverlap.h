@@ -0,0 +1,102 @@
+#ifndef _BUFFEROVERLAP_H_
+#define _BUFFEROVERLAP_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+
+#include "common.h"
+#include "rootpointer.h"
+
+// Size of an access that may touch any byte of its object, e.g., through
+// a variable index in a callee
+static const uint64_t UnboundedSize = ~0ULL;
+
+/// A memory access in a race window, covering the bytes
+/// [Offset, Offset + Size) from a base pointer. The base is the accessed
+/// pointer with constant GEPs and casts stripped, so that accesses
+/// through the same base can be compared byte by byte.
+struct BufferAccess {
+    Instruction *Inst;
+    Value *Base;
+    int64_t Offset;
+    // Zero if the size is unknown, UnboundedSize if any byte of the
+    // object may be accessed
+    uint64_t Size;
+    bool IsWrite;
+    // The pointer is a GEP, i.e., an element or a field of its object
+    bool IsElement;
+};
+
+/// Accesses of a race window indexed for overlap queries. The accesses
+/// through each base are kept as intervals sorted by start offset along
+/// with the running maximum of their end offsets, so that a query is a
+/// binary search followed by a backward scan that stops as soon as no
+/// earlier interval reaches the queried range. Bases are also grouped by
+/// their root pointers to find accesses through other bases that may
+/// alias the queried buffer.
+class BufferOverlapIndex {
+private:
+    struct Interval {
+        int64_t Start;
+        int64_t End;
+        // Maximum end of the intervals up to this one
+        int64_t MaxEnd;
+        unsigned Access;
+    };
+
+    RootPointerResolver *RootPointers;
+    // Own copy, since struct layouts are computed lazily and other
+    // threads may use the layout of the module
+    DataLayout DL;
+
+    vector<BufferAccess> Accesses;
+    // Intervals of the accesses through each base, in the order the bases
+    // are first accessed
+    MapVector<Value *, vector<Interval>> BaseIntervals;
+    // Bases of the accesses sharing a root pointer
+    DenseMap<Value *, SmallVector<Value *, 4>> RootBases;
+
+public:
+    BufferOverlapIndex(RootPointerResolver *, const DataLayout &);
+
+    /// Locate a pointer as a base and a constant offset from it. The
+    /// layout must not be shared with other threads.
+    static void getLocation(Value *, const DataLayout &, BufferAccess &);
+
+    const DataLayout &getLayout(void) const {
+        return DL;
+    }
+
+    void getLocation(Value *Ptr, BufferAccess &A) {
+        getLocation(Ptr, DL, A);
+    }
+
+    /// Add an access. Accesses are numbered in the order they are added.
+    void addAccess(Instruction *, Value *Ptr, uint64_t Size, bool IsWrite);
+
+    /// Add an access that is already located
+    void addAccess(const BufferAccess &);
+
+    /// Build the index once all the accesses of the window are added
+    void build(void);
+
+    /// Collect the accesses that conflict with an access of Size bytes to
+    /// Ptr, in increasing order. Unknown sizes reach from the accessed
+    /// offset to the end of the object. Elements accessed through different
+    /// bases of the same root are compared by their constant offsets, and
+    /// assumed not to overlap if either is behind a variable index.
+    void findOverlaps(Value *Ptr, uint64_t Size, bool IsWrite,
+                      SmallVectorImpl<unsigned> &);
+
+    /// Collect the accesses that conflict with a located access
+    void findOverlaps(const BufferAccess &, SmallVectorImpl<unsigned> &);
+
+    BufferAccess &getAccess(unsigned Idx) {
+        return Accesses[Idx];
+    }
+};
+
+#endif
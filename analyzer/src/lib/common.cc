@@ -1,5 +1,3 @@
-#include <fstream>
-
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Instructions.h"
@@ -7,57 +5,49 @@
 #include "llvm/IR/CFG.h"
 
 #include "common.h"
+#include "sourcecache.h"
 
-static const string MPINonblockingAPIs[] = {
-    "MPI_Isend", "MPI_Irsend", "MPI_Irecv"
-};
+// Output stream of the current thread, NULL for llvm::errs()
+static thread_local raw_ostream *ThreadOutput = NULL;
 
-static const string MPIBlockingAPIs[] = {
-    "MPI_Send", "MPI_Recv"
-};
-
-static const string MPIWaitAPIs[] = {
-    "MPI_Wait", "MPI_Waitall", "MPI_Waitany"
-};
+raw_ostream &getOutputStream(void) {
+    if (ThreadOutput)
+        return *ThreadOutput;
+    return llvm::errs();
+}
 
-static const string MPIWriteAPIs[] = {
-    "MPI_Irecv", "MPI_Recv"
-};
+/// Redirect OP of the current thread and return the previous stream
+raw_ostream *setOutputStream(raw_ostream *OS) {
+    raw_ostream *PrevOS = ThreadOutput;
+    ThreadOutput = OS;
+    return PrevOS;
+}
 
 static const string CPPSTLAPIs[] = {
     "_ZNSt6vectorIiSaIiEEixEm"
 };
 
 bool isMPINonblockingAPI(StringRef Name) {
-    for (auto API: MPINonblockingAPIs) {
-        if (Name.equals(API))
-            return true;
-    }
-    return false;
+    return classifyMPIAPI(Name) == MPINonblockingAPI;
 }
 
 bool isMPIBlockingAPI(StringRef Name) {
-    for (auto API: MPIBlockingAPIs) {
-        if (Name.equals(API))
-            return true;
-    }
-    return false;
+    return classifyMPIAPI(Name) == MPIBlockingAPI;
 }
 
 bool isMPIWaitAPI(StringRef Name) {
-    for (auto API: MPIWaitAPIs) {
-        if (Name.equals(API))
-            return true;
-    }
-    return false;
+    return classifyMPIAPI(Name) == MPIWaitAPI;
 }
 
+/// Check whether an MPI call writes its (first) buffer
 bool isMPIWriteAPI(StringRef Name) {
-    for (auto API: MPIWriteAPIs) {
-        if (Name.equals(API))
-            return true;
-    }
-    return false;
+    const MPIAPISpec *Spec = lookupMPIAPI(Name);
+    return Spec && Spec->isBufferWrite();
+}
+
+MPIAPIKind classifyMPIAPI(StringRef Name) {
+    const MPIAPISpec *Spec = lookupMPIAPI(Name);
+    return Spec ? Spec->Kind : NotMPIAPI;
 }
 
 bool isCPPSTLAPI(StringRef Name) {
@@ -84,7 +74,7 @@ bool isConstantIdx(GetElementPtrInst *G) {
 }
 
 /// Add successor blocks of the input block into a list
-void addSuccessorBlocks(BasicBlock *BB, list<BasicBlock *> &BBL) {
+void addSuccessorBlocks(BasicBlock *BB, SmallVectorImpl<BasicBlock *> &BBL) {
     Instruction *TI = BB->getTerminator();
     for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
         BasicBlock *Succ = TI->getSuccessor(i);
@@ -92,28 +82,18 @@ void addSuccessorBlocks(BasicBlock *BB, list<BasicBlock *> &BBL) {
     }
 }
 
-/// Add predecessor blocks of the input block into a list
-void addPredecessorBlocks(BasicBlock *BB, list<BasicBlock *> &BBL) {
-    for (auto it = pred_begin(BB), ie = pred_end(BB); it != ie; ++it) {
-        BasicBlock *Pred = *it;
-        BBL.push_back(Pred);
-    }
-}
-
 /// Check whether the Dst block is reachable from the Src block
 bool isReachable(BasicBlock *Src, BasicBlock *Dst) {
     if (Src == Dst)
         return true;
 
-    set<BasicBlock *> visitedBBs;
-    list<BasicBlock *> toBeVisitedBBs;
+    SmallPtrSet<BasicBlock *, 32> visitedBBs;
+    SmallVector<BasicBlock *, 32> toBeVisitedBBs;
     addSuccessorBlocks(Src, toBeVisitedBBs);
-    while (!toBeVisitedBBs.empty()) {
-        BasicBlock *curBB = toBeVisitedBBs.front();
-        toBeVisitedBBs.pop_front();
-        if (visitedBBs.count(curBB) != 0)
+    for (unsigned i = 0; i < toBeVisitedBBs.size(); ++i) {
+        BasicBlock *curBB = toBeVisitedBBs[i];
+        if (!visitedBBs.insert(curBB).second)
             continue;
-        visitedBBs.insert(curBB);
         if (curBB == Dst)
             return true;
         addSuccessorBlocks(curBB, toBeVisitedBBs);
@@ -134,7 +114,7 @@ bool isLoadFromSameAddr(Value *A, Value *B) {
 
 string getSourceLine(Instruction *I) {
     string SrcLineInfo = "";
-    MDNode *MN = I->getMetadata("dbg");
+    MDNode *MN = I->getMetadata(LLVMContext::MD_dbg);
     if (!MN)
         return SrcLineInfo;
 
@@ -148,20 +128,14 @@ string getSourceLine(Instruction *I) {
 
     string SrcDir = Loc->getDirectory().str();
     string SrcFileName = Loc->getFilename().str();
-    ifstream SrcFile(SrcDir + '/' + SrcFileName);
-    unsigned cl = 0;
-
-    while(1) {
-        string SrcLine;
-        getline(SrcFile, SrcLine);
-        cl++;
-        if (cl != LineNo)
-            continue;
-
-        SrcLineInfo = SrcFileName + ":" +
-                      to_string(LineNo) + ": " + SrcLine;
-        return SrcLineInfo;
-    }
+    // A missing file or line is reported with an empty source line
+    string SrcLine;
+    SourceFileCache::getInstance().getLine(SrcDir + '/' + SrcFileName,
+                                           LineNo, SrcLine);
+
+    SrcLineInfo = SrcFileName + ":" +
+                  to_string(LineNo) + ": " + SrcLine;
+    return SrcLineInfo;
 }
 
 uint64_t parseAccessSize(Value *Count, Value *DataType) {
@@ -217,67 +191,3 @@ uint64_t getAccessSizeFromPointerType(Type *PtrType) {
 
     return 0;
 }
-
-void collectRootPointers(Value *Ptr, set<Value *> &RPtrs) {
-    if (AllocaInst *AI = dyn_cast<AllocaInst>(Ptr))
-        RPtrs.insert(Ptr);
-    else if (GlobalValue *GV = dyn_cast<GlobalValue>(Ptr))
-        RPtrs.insert(Ptr);
-    else if (ConstantPointerNull *CPN = dyn_cast<ConstantPointerNull>(Ptr))
-        RPtrs.insert(Ptr);
-    else if (BitCastInst *BCI = dyn_cast<BitCastInst>(Ptr))
-        return collectRootPointers(BCI->getOperand(0), RPtrs);
-    else if (GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(Ptr))
-        return collectRootPointers(GEPI->getPointerOperand(), RPtrs);
-    else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(Ptr))
-        return collectRootPointers(CE->getAsInstruction(), RPtrs);
-    else if (CallBase *CI = dyn_cast<CallBase>(Ptr)) {
-        Function *CalledFunc = CI->getCalledFunction();
-        StringRef CalledFuncName = CalledFunc->getName();
-        if (CalledFuncName.equals("malloc"))
-            RPtrs.insert(Ptr);
-        else if (isCPPSTLAPI(CalledFuncName))
-            RPtrs.insert(CI->getArgOperand(0));
-        else
-            OP << "== Error: unsupported call: " << *CI << "\n";
-    } else if (LoadInst *LI = dyn_cast<LoadInst>(Ptr)) {
-        Value *Addr = LI->getPointerOperand();
-        // Try to find a store instruction that stores to the same address
-        Instruction *PrevInst = LI->getPrevNonDebugInstruction();
-        while(PrevInst) {
-            if (StoreInst *SI = dyn_cast<StoreInst>(PrevInst)) {
-                if (SI->getPointerOperand() == Addr)
-                    return collectRootPointers(SI->getValueOperand(), RPtrs);
-            }
-            PrevInst = PrevInst->getPrevNonDebugInstruction();
-        }
-        // Continue to check predecessor blocks
-        set<BasicBlock *> visitedBBs;
-        list<BasicBlock *> toBeVisitedBBs;
-        addPredecessorBlocks(LI->getParent(), toBeVisitedBBs);
-        while (!toBeVisitedBBs.empty()) {
-            BasicBlock *curBB = toBeVisitedBBs.front();
-            toBeVisitedBBs.pop_front();
-            if (visitedBBs.count(curBB) != 0)
-                continue;
-            visitedBBs.insert(curBB);
-            PrevInst = curBB->getTerminator();
-            bool stop = false;
-            while(PrevInst) {
-                //OP << " == " << *PrevInst << "\n";
-                if (StoreInst *SI = dyn_cast<StoreInst>(PrevInst)) {
-                    if (SI->getPointerOperand() == Addr) {
-                        collectRootPointers(SI->getValueOperand(), RPtrs);
-                        stop = true;
-                        break;
-                    }
-                }
-                PrevInst = PrevInst->getPrevNonDebugInstruction();
-            }
-            if (!stop)
-                addPredecessorBlocks(curBB, toBeVisitedBBs);
-        }
-    } else
-        OP << KYEL "== Unsupported pointer in collectRootPointers(): \n"
-           <<  *Ptr << "\n" << KNRM;
-}
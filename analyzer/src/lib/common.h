@@ -1,16 +1,24 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <map>
 #include <set>
 #include <list>
 #include <vector>
 #include <unordered_map>
 
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "mpiapi.h"
+
 using namespace llvm;
 using namespace std;
 
-// Output
-#define OP llvm::errs()
+// Output. Defaults to llvm::errs(), but each thread can redirect it
+// (e.g., to buffer the report of a function analyzed by a worker).
+#define OP getOutputStream()
 
 // Different colors for output
 #define KNRM  "\x1B[0m"   /* Normal */
@@ -22,6 +30,10 @@ using namespace std;
 #define KCYN  "\x1B[36m"  /* Cyan */
 #define KWHT  "\x1B[37m"  /* White */
 
+extern raw_ostream &getOutputStream(void);
+
+extern raw_ostream *setOutputStream(raw_ostream *);
+
 extern bool isMPINonblockingAPI(StringRef);
 
 extern bool isMPIBlockingAPI(StringRef);
@@ -30,11 +42,13 @@ extern bool isMPIWaitAPI(StringRef);
 
 extern bool isMPIWriteAPI(StringRef);
 
+extern MPIAPIKind classifyMPIAPI(StringRef);
+
 extern bool isCPPSTLAPI(StringRef);
 
 extern bool isConstantIdx(GetElementPtrInst *);
 
-extern void addSuccessorBlocks(BasicBlock *, list<BasicBlock *> &);
+extern void addSuccessorBlocks(BasicBlock *, SmallVectorImpl<BasicBlock *> &);
 
 extern bool isReachable(BasicBlock *, BasicBlock *);
 
@@ -46,6 +60,4 @@ extern uint64_t parseAccessSize(Value *, Value *);
 
 extern uint64_t getAccessSizeFromPointerType(Type *);
 
-extern void collectRootPointers(Value *, set<Value *> &);
-
 #endif
@@ -0,0 +1,263 @@
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include "daemon.h"
+#include "loader.h"
+#include "mpirace.h"
+#include "sourcecache.h"
+
+static const char *StopRequest = "stop";
+// A request is a list of paths. Larger or stalled requests are dropped,
+// so that one client cannot exhaust the memory or hold up the others.
+static const size_t MaxRequestSize = 16 << 20;
+static const unsigned RequestTimeout = 30;
+
+/// Set up the address of a Unix socket, false if the path is too long
+static bool getSocketAddress(StringRef Path, sockaddr_un &Addr) {
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(Addr.sun_path))
+        return false;
+    memcpy(Addr.sun_path, Path.data(), Path.size());
+    return true;
+}
+
+/// Read from a socket until the peer shuts down its side, failing past
+/// MaxSize bytes (0 for no limit) or when a receive timeout expires
+static bool readAll(int FD, string &Data, size_t MaxSize = 0) {
+    char Buf[4096];
+    while (true) {
+        ssize_t N = read(FD, Buf, sizeof(Buf));
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N < 0)
+            return false;
+        if (N == 0)
+            return true;
+        if (MaxSize && Data.size() + N > MaxSize)
+            return false;
+        Data.append(Buf, N);
+    }
+}
+
+/// Write all of Data, without dying of SIGPIPE if the peer went away
+static bool writeAll(int FD, StringRef Data) {
+    const char *P = Data.data();
+    size_t Left = Data.size();
+    while (Left) {
+        ssize_t N = send(FD, P, Left, MSG_NOSIGNAL);
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N <= 0)
+            return false;
+        P += N;
+        Left -= N;
+    }
+    return true;
+}
+
+AnalysisDaemon::AnalysisDaemon(GlobalContext *Ctx_, StringRef Socket,
+                               bool Lazy_)
+    : Ctx(Ctx_), SocketPath(Socket.str()), Lazy(Lazy_),
+      Pass(new MPIRacePass(Ctx_)) {
+}
+
+AnalysisDaemon::~AnalysisDaemon(void) {
+    // Modules go before the pass, which prints the final statistics
+    Modules.clear();
+    Pass.reset();
+}
+
+/// Parse a file again if it changed since it was last parsed
+bool AnalysisDaemon::refresh(const string &Path, ModuleState &MS,
+                             bool &Changed, string &Error) {
+    sys::fs::file_status Status;
+    if (error_code EC = sys::fs::status(Path, Status)) {
+        Error = EC.message();
+        return false;
+    }
+    Changed = !MS.M || MS.ModTime != Status.getLastModificationTime() ||
+              MS.Size != Status.getSize();
+    if (!Changed)
+        return true;
+
+    // The old module goes before its context
+    MS.M.reset();
+    MS.LLVMCtx.reset(new LLVMContext());
+    SMDiagnostic Err;
+    MS.M = loadIRFile(Path, Err, *MS.LLVMCtx, Lazy);
+    if (!MS.M) {
+        Error = Err.getMessage().str();
+        return false;
+    }
+    MS.ModTime = Status.getLastModificationTime();
+    MS.Size = Status.getSize();
+    return true;
+}
+
+void AnalysisDaemon::analyze(ModuleState &MS) {
+    MS.Report.clear();
+    raw_string_ostream OS(MS.Report);
+    raw_ostream *PrevOS = setOutputStream(&OS);
+    while (Pass->doInitialization(MS.M.get()))
+        ;
+    // Passes of a single module iterate until the module no longer
+    // changes, as in the streaming mode
+    while (Pass->doModulePass(MS.M.get()))
+        ;
+    while (Pass->doFinalization(MS.M.get()))
+        ;
+    OS.flush();
+    setOutputStream(PrevOS);
+}
+
+string AnalysisDaemon::handleRequest(StringRef Request, bool &Stop) {
+    chrono::steady_clock::time_point Start = chrono::steady_clock::now();
+    SmallVector<StringRef, 16> Files;
+    Request.split(Files, '\n', -1, false);
+    Stop = Files.size() == 1 && Files[0] == StopRequest;
+    if (Stop)
+        return "== Daemon stopped\n";
+    // Source lines of the reports are read again if they changed
+    SourceFileCache::getInstance().revalidate();
+
+    string Reply;
+    raw_string_ostream OS(Reply);
+    unsigned NumAnalyzed = 0;
+    for (StringRef File : Files) {
+        string Path = File.str();
+        ModuleState &MS = Modules[Path];
+        bool Changed = false;
+        string Error;
+        if (!refresh(Path, MS, Changed, Error)) {
+            OS << "== Error loading file '" << Path << "': " << Error
+               << "\n";
+            Modules.erase(Path);
+            continue;
+        }
+        if (Changed) {
+            analyze(MS);
+            ++NumAnalyzed;
+        }
+        OS << "== " << Path << (Changed ? " (analyzed)" : " (unchanged)")
+           << "\n" << MS.Report;
+    }
+
+    double Elapsed = chrono::duration<double>(
+                         chrono::steady_clock::now() - Start).count();
+    OS << "== Analyzed " << NumAnalyzed << " of " << Files.size()
+       << " file(s) in " << format("%.3f", Elapsed) << " s\n";
+    return OS.str();
+}
+
+void AnalysisDaemon::preload(const vector<string> &Files) {
+    string Request;
+    for (const string &File : Files) {
+        SmallString<256> Path(File);
+        sys::fs::make_absolute(Path);
+        sys::path::remove_dots(Path, true);
+        Request += Path.str().str() + "\n";
+    }
+    bool Stop;
+    OP << handleRequest(Request, Stop);
+}
+
+bool AnalysisDaemon::serve(void) {
+    sockaddr_un Addr;
+    if (!getSocketAddress(SocketPath, Addr)) {
+        OP << "== Error: socket path too long: " << SocketPath << "\n";
+        return false;
+    }
+    int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Listener < 0) {
+        OP << "== Error: cannot create socket: " << strerror(errno) << "\n";
+        return false;
+    }
+    // A stale socket of a previous daemon would make bind fail
+    unlink(SocketPath.c_str());
+    if (bind(Listener, (sockaddr *)&Addr, sizeof(Addr)) ||
+        listen(Listener, 16)) {
+        OP << "== Error: cannot listen on " << SocketPath << ": "
+           << strerror(errno) << "\n";
+        close(Listener);
+        return false;
+    }
+    OP << "== Listening on " << SocketPath << "\n";
+
+    bool Stop = false;
+    while (!Stop) {
+        int FD = accept(Listener, NULL, NULL);
+        if (FD < 0) {
+            if (errno == EINTR)
+                continue;
+            OP << "== Error: accept failed: " << strerror(errno) << "\n";
+            break;
+        }
+        timeval Timeout = {RequestTimeout, 0};
+        setsockopt(FD, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+        setsockopt(FD, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout));
+        string Request;
+        if (readAll(FD, Request, MaxRequestSize))
+            writeAll(FD, handleRequest(Request, Stop));
+        else
+            OP << "== Dropped a request that was too large, timed out or "
+               << "failed\n";
+        close(FD);
+    }
+
+    close(Listener);
+    unlink(SocketPath.c_str());
+    return true;
+}
+
+int runDaemonClient(StringRef Socket, const vector<string> &Files,
+                    bool Stop) {
+    sockaddr_un Addr;
+    if (!getSocketAddress(Socket, Addr)) {
+        OP << "== Error: socket path too long: " << Socket << "\n";
+        return 1;
+    }
+    int FD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0 || connect(FD, (sockaddr *)&Addr, sizeof(Addr))) {
+        OP << "== Error: cannot connect to " << Socket << ": "
+           << strerror(errno) << "\n";
+        if (FD >= 0)
+            close(FD);
+        return 1;
+    }
+
+    // The daemon may run in another directory
+    string Request;
+    if (Stop)
+        Request = string(StopRequest) + "\n";
+    else {
+        for (const string &File : Files) {
+            SmallString<256> Path(File);
+            sys::fs::make_absolute(Path);
+            sys::path::remove_dots(Path, true);
+            Request += Path.str().str() + "\n";
+        }
+    }
+    string Reply;
+    bool OK = writeAll(FD, Request) && !shutdown(FD, SHUT_WR) &&
+              readAll(FD, Reply);
+    close(FD);
+    if (!OK) {
+        OP << "== Error: lost connection to " << Socket << "\n";
+        return 1;
+    }
+    OP << Reply;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Chrono.h"
+
+#include "global.h"
+
+class MPIRacePass;
+
+/// Resident analysis server listening on a Unix socket. It keeps the
+/// modules it parsed and their reports in memory, and on each request
+/// only re-parses and re-analyzes the files whose modification time or
+/// size changed since they were last analyzed.
+///
+/// A request is a list of bitcode files, one absolute path per line, or
+/// the single line "stop". The reply is the report of each file in the
+/// order of the request.
+class AnalysisDaemon {
+private:
+    struct ModuleState {
+        unique_ptr<LLVMContext> LLVMCtx;
+        unique_ptr<Module> M;
+        sys::TimePoint<> ModTime;
+        uint64_t Size;
+        // Output of the analysis of the module
+        string Report;
+    };
+
+    GlobalContext *Ctx;
+    string SocketPath;
+    bool Lazy;
+    // Kept across requests along with its thread pool and result cache
+    unique_ptr<MPIRacePass> Pass;
+    StringMap<ModuleState> Modules;
+
+    bool refresh(const string &Path, ModuleState &, bool &Changed,
+                 string &Error);
+
+    void analyze(ModuleState &);
+
+    string handleRequest(StringRef Request, bool &Stop);
+
+public:
+    AnalysisDaemon(GlobalContext *, StringRef Socket, bool Lazy);
+
+    ~AnalysisDaemon(void);
+
+    /// Parse and analyze files before serving, e.g., the whole program
+    void preload(const vector<string> &Files);
+
+    /// Serve requests one at a time until a client stops the daemon.
+    /// Returns false if the socket cannot be set up.
+    bool serve(void);
+};
+
+/// Send bitcode files to a daemon, or ask it to stop, and print its
+/// reply. Returns the exit status of the client.
+int runDaemonClient(StringRef Socket, const vector<string> &Files,
+                    bool Stop);
+
+#endif
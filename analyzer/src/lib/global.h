@@ -1,8 +1,14 @@
 #ifndef _GLOBAL_H_
 #define _GLOBAL_H_
 
+#include <chrono>
+
 #include "common.h"
 
+class CombinedSummaryIndex;
+class ModuleLoader;
+class ReportWriter;
+
 typedef vector<pair<llvm::Module *, llvm::StringRef>> ModuleList;
 typedef unordered_map<llvm::Module *, llvm::StringRef> ModuleNameMap;
 
@@ -10,11 +16,75 @@ struct GlobalContext {
     GlobalContext() {
         // Initialize global statistics
         NumFunctions = 0;
+
+        // Default options
+        VerboseLevel = 0;
+        NumThreads = 1;
+        SplitFunctionSize = 0;
+        DataflowMode = false;
+        Interprocedural = false;
+        Imports = NULL;
+        Reports = NULL;
+        MaxFunctionBlocks = 0;
+        MaxCallBlocks = 0;
+        FunctionTimeLimit = 0;
+        CallTimeLimit = 0;
+        HasDeadline = false;
     }
 
     // Global statistics
     unsigned NumFunctions;
 
+    // Print statistics if greater than zero
+    unsigned VerboseLevel;
+
+    // Chrome trace of the analysis phases, empty if not traced
+    string TraceFile;
+
+    // Number of analysis threads
+    unsigned NumThreads;
+
+    // Functions with at least this many blocks get one task per
+    // nonblocking call in the parallel mode
+    unsigned SplitFunctionSize;
+
+    // Check all the nonblocking calls of a function in one dataflow pass
+    // instead of walking from each call to its wait calls
+    bool DataflowMode;
+
+    // Check calls of defined functions against their summaries
+    bool Interprocedural;
+
+    // Summary file written for each module, empty if none
+    string SummaryFile;
+
+    // Summaries combined from the summary files of other modules, NULL
+    // unless combining
+    const CombinedSummaryIndex *Imports;
+
+    // Directory of the on-disk result cache, empty if disabled
+    string ResultCacheDir;
+
+    // Writer of the race records, NULL if races are only printed
+    ReportWriter *Reports;
+
+    // Blocks visited and seconds spent per function and per nonblocking
+    // call before its analysis is cut short, zero for no limit
+    uint64_t MaxFunctionBlocks;
+    uint64_t MaxCallBlocks;
+    double FunctionTimeLimit;
+    double CallTimeLimit;
+
+    // End of the run. Functions are then analyzed cheapest first within
+    // each module, and those not started by the deadline are skipped, as
+    // are the input files not parsed or analyzed by then.
+    bool HasDeadline;
+    std::chrono::steady_clock::time_point Deadline;
+
+    bool isPastDeadline(void) const {
+        return HasDeadline && std::chrono::steady_clock::now() >= Deadline;
+    }
+
     ModuleList Modules;
     ModuleNameMap ModuleMaps;
 };
@@ -42,7 +112,26 @@ public:
         return false;
     }
 
+    // Skip an input file once the deadline has passed, true if skipped
+    bool skipAtDeadline(llvm::StringRef name);
+
+    // Run the iterative pass until no module changes
+    void iterate(ModuleList &modules, unsigned iter, unsigned changed);
+
     virtual void run(ModuleList &modules);
+
+    // Run on modules as the loader parses them, then iterate as usual
+    virtual void run(ModuleLoader &loader);
+
+    // Run on a module alone, as the index-th of total modules, until it
+    // no longer changes
+    void runOnModule(llvm::Module *M, llvm::StringRef name, unsigned index,
+                     unsigned total);
+
+    // Run on one module at a time as the loader parses it, releasing each
+    // module once it is done. Only for passes that never look at other
+    // modules.
+    virtual void stream(ModuleLoader &loader);
 };
 
 #endif
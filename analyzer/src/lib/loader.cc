@@ -0,0 +1,324 @@
+#include <sys/resource.h>
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/LLVMBitCodes.h"
+#include "llvm/Bitstream/BitstreamReader.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Object/IRSymtab.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include "common.h"
+#include "loader.h"
+#include "stats.h"
+
+static bool callsMPIAPI(Function &F) {
+    for (Function::iterator bt = F.begin(), be = F.end(); bt != be; ++bt) {
+        for (BasicBlock::iterator it = bt->begin(), ie = bt->end();
+             it != ie; ++it) {
+            CallBase *CI = dyn_cast<CallBase>(&*it);
+            if (!CI)
+                continue;
+            Function *Callee = CI->getCalledFunction();
+            if (Callee && classifyMPIAPI(Callee->getName()) != NotMPIAPI)
+                return true;
+        }
+    }
+    return false;
+}
+
+unique_ptr<Module> loadIRFile(const string &FileName, SMDiagnostic &Err,
+                              LLVMContext &Ctx, bool Lazy) {
+    PhaseTimer PT(ParsePhase, FileName);
+    if (!Lazy)
+        return parseIRFile(FileName, Err, Ctx);
+
+    unique_ptr<Module> M = getLazyIRFileModule(FileName, Err, Ctx);
+    if (!M)
+        return NULL;
+
+    bool HasMPIFuncs = false;
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        if (classifyMPIAPI(f->getName()) != NotMPIAPI) {
+            HasMPIFuncs = true;
+            break;
+        }
+    }
+    if (!HasMPIFuncs)
+        return M;
+
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        Function &F = *f;
+        if (!F.isMaterializable())
+            continue;
+        if (Error E = F.materialize()) {
+            Err = SMDiagnostic(FileName, SourceMgr::DK_Error,
+                               toString(move(E)));
+            return NULL;
+        }
+        if (!callsMPIAPI(F))
+            F.deleteBody();
+    }
+    return M;
+}
+
+/// Check the symbols of a bitcode symbol table for MPI APIs. Defined ones
+/// count too, since calls to them are MPI calls, e.g., in a module that
+/// stubs or wraps the APIs. Returns false in Valid if the table is of
+/// another version or does not fit in the file.
+static bool symtabHasMPISymbols(StringRef Symtab, StringRef Strtab,
+                                bool &Valid) {
+    using namespace irsymtab::storage;
+    Valid = false;
+    if (Symtab.size() < sizeof(Header))
+        return false;
+    const Header *Hdr = reinterpret_cast<const Header *>(Symtab.data());
+    if (Hdr->Version != Header::kCurrentVersion)
+        return false;
+    uint64_t SymbolsEnd =
+        (uint64_t)Hdr->Symbols.Offset + (uint64_t)Hdr->Symbols.Size *
+                                            sizeof(irsymtab::storage::Symbol);
+    if (SymbolsEnd > Symtab.size())
+        return false;
+
+    for (const irsymtab::storage::Symbol &Sym : Hdr->Symbols.get(Symtab)) {
+        if ((uint64_t)Sym.IRName.Offset + Sym.IRName.Size > Strtab.size())
+            return false;
+        if (classifyMPIAPI(Sym.IRName.get(Strtab)) != NotMPIAPI) {
+            Valid = true;
+            return true;
+        }
+    }
+    Valid = true;
+    return false;
+}
+
+/// Read the string tables of a bitcode file, which hold the names of the
+/// globals of its modules, without reading the modules. Returns false if
+/// there are none, e.g., in bitcode older than string tables.
+static bool readStringTables(MemoryBufferRef Buf,
+                             SmallVectorImpl<StringRef> &Strtabs) {
+    const unsigned char *Begin =
+        (const unsigned char *)Buf.getBufferStart();
+    const unsigned char *End = (const unsigned char *)Buf.getBufferEnd();
+    if (isBitcodeWrapper(Begin, End) &&
+        SkipBitcodeWrapperHeader(Begin, End, true))
+        return false;
+    BitstreamCursor Stream(ArrayRef<uint8_t>(Begin, End));
+    // The magic number was checked when reading the file contents
+    if (Error E = Stream.JumpToBit(32)) {
+        consumeError(move(E));
+        return false;
+    }
+
+    while (!Stream.AtEndOfStream()) {
+        Expected<BitstreamEntry> Entry = Stream.advance();
+        if (!Entry) {
+            consumeError(Entry.takeError());
+            return false;
+        }
+        // Padding after the last block
+        if (Entry->Kind != BitstreamEntry::SubBlock)
+            break;
+        if (Entry->ID != bitc::STRTAB_BLOCK_ID) {
+            if (Error E = Stream.SkipBlock()) {
+                consumeError(move(E));
+                return false;
+            }
+            continue;
+        }
+        if (Error E = Stream.EnterSubBlock(bitc::STRTAB_BLOCK_ID)) {
+            consumeError(move(E));
+            return false;
+        }
+        while (true) {
+            Expected<BitstreamEntry> Rec = Stream.advance();
+            if (!Rec) {
+                consumeError(Rec.takeError());
+                return false;
+            }
+            if (Rec->Kind == BitstreamEntry::EndBlock)
+                break;
+            if (Rec->Kind != BitstreamEntry::Record)
+                return false;
+            SmallVector<uint64_t, 1> Record;
+            StringRef Blob;
+            Expected<unsigned> Code = Stream.readRecord(Rec->ID, Record, &Blob);
+            if (!Code) {
+                consumeError(Code.takeError());
+                return false;
+            }
+            if (*Code == bitc::STRTAB_BLOB)
+                Strtabs.push_back(Blob);
+        }
+    }
+    return !Strtabs.empty();
+}
+
+bool mayCallMPIAPI(const string &FileName) {
+    PhaseTimer PT(ParsePhase, FileName);
+    // Mapped, so that only the pages of the tables are read
+    ErrorOr<unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(
+        FileName, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!Buf)
+        return true;
+    MemoryBufferRef Ref = (*Buf)->getMemBufferRef();
+    const unsigned char *Begin =
+        (const unsigned char *)Ref.getBufferStart();
+    if (!isBitcode(Begin, Begin + Ref.getBufferSize()))
+        return true;
+    Expected<BitcodeFileContents> Contents = getBitcodeFileContents(Ref);
+    if (!Contents) {
+        consumeError(Contents.takeError());
+        return true;
+    }
+
+    if (!Contents->Symtab.empty()) {
+        bool Valid;
+        bool HasSymbols = symtabHasMPISymbols(
+            Contents->Symtab, Contents->StrtabForSymtab, Valid);
+        if (Valid)
+            return HasSymbols;
+    }
+
+    // Names are not delimited in a string table, so look for the prefix
+    SmallVector<StringRef, 1> Strtabs;
+    if (!readStringTables(Ref, Strtabs))
+        return true;
+    for (StringRef Strtab : Strtabs) {
+        if (Strtab.contains("MPI_"))
+            return true;
+    }
+    return false;
+}
+
+uint64_t getPeakRSS(void) {
+    struct rusage RU;
+    if (getrusage(RUSAGE_SELF, &RU))
+        return 0;
+#ifdef __APPLE__
+    return RU.ru_maxrss;
+#else
+    return (uint64_t)RU.ru_maxrss * 1024;
+#endif
+}
+
+ModuleLoader::ModuleLoader(const vector<string> &Files, unsigned NumThreads,
+                           unsigned MaxQueued_, bool Lazy_,
+                           uint64_t MaxMemory_)
+    : FileNames(Files), MaxQueued(MaxQueued_ ? MaxQueued_ : 1), Lazy(Lazy_),
+      MaxMemory(MaxMemory_), Slots(Files.size()), Ready(Files.size(), false),
+      NextToLoad(0), NextToConsume(0), InUse(0), Stopping(false) {
+    if (NumThreads == 0)
+        NumThreads = 1;
+    for (unsigned i = 0; i < NumThreads; ++i)
+        Loaders.push_back(thread(&ModuleLoader::loaderLoop, this));
+}
+
+ModuleLoader::~ModuleLoader(void) {
+    {
+        lock_guard<mutex> Guard(Lock);
+        Stopping = true;
+    }
+    CanLoad.notify_all();
+    for (auto &T : Loaders)
+        T.join();
+
+    // Release modules that were parsed but never taken
+    for (unsigned i = NextToConsume; i < Slots.size(); ++i) {
+        if (!Ready[i])
+            continue;
+        delete Slots[i].M;
+        delete Slots[i].LLVMCtx;
+    }
+}
+
+/// Check whether another module may be parsed under the memory limit.
+/// Called with the lock held.
+bool ModuleLoader::hasMemoryForNext(void) {
+    if (MaxMemory == 0)
+        return true;
+    // Always make progress once everything else is released
+    if (InUse == 0 && NextToLoad == NextToConsume)
+        return true;
+    return sys::Process::GetMallocUsage() < MaxMemory;
+}
+
+void ModuleLoader::loaderLoop(void) {
+    unique_lock<mutex> Guard(Lock);
+    while (true) {
+        CanLoad.wait(Guard, [this]() {
+            return Stopping || NextToLoad >= FileNames.size() ||
+                   (NextToLoad < NextToConsume + MaxQueued &&
+                    hasMemoryForNext());
+        });
+        if (Stopping || NextToLoad >= FileNames.size())
+            return;
+        unsigned Idx = NextToLoad++;
+        Guard.unlock();
+
+        LoadedModule LM;
+        LM.FileName = FileNames[Idx];
+        LM.LLVMCtx = new LLVMContext();
+        SMDiagnostic Err;
+        unique_ptr<Module> M =
+            loadIRFile(FileNames[Idx], Err, *LM.LLVMCtx, Lazy);
+        LM.M = M.release();
+        if (!LM.M) {
+            delete LM.LLVMCtx;
+            LM.LLVMCtx = NULL;
+        }
+
+        Guard.lock();
+        Slots[Idx] = LM;
+        Ready[Idx] = true;
+        Loaded.notify_all();
+    }
+}
+
+bool ModuleLoader::next(LoadedModule &LM) {
+    unique_lock<mutex> Guard(Lock);
+    if (NextToConsume >= Slots.size())
+        return false;
+    Loaded.wait(Guard, [this]() {
+        return Ready[NextToConsume] ||
+               (Stopping && NextToConsume >= NextToLoad);
+    });
+    if (!Ready[NextToConsume]) {
+        LM.FileName = FileNames[NextToConsume++];
+        LM.LLVMCtx = NULL;
+        LM.M = NULL;
+        return true;
+    }
+    LM = Slots[NextToConsume++];
+    if (LM.M)
+        ++InUse;
+    CanLoad.notify_all();
+    return true;
+}
+
+void ModuleLoader::stop(void) {
+    {
+        lock_guard<mutex> Guard(Lock);
+        Stopping = true;
+    }
+    CanLoad.notify_all();
+    Loaded.notify_all();
+}
+
+void ModuleLoader::release(LoadedModule &LM) {
+    if (!LM.M)
+        return;
+    delete LM.M;
+    delete LM.LLVMCtx;
+    LM.M = NULL;
+    LM.LLVMCtx = NULL;
+    {
+        lock_guard<mutex> Guard(Lock);
+        --InUse;
+    }
+    CanLoad.notify_all();
+}
@@ -0,0 +1,96 @@
+#ifndef _LOADER_H_
+#define _LOADER_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+
+using namespace llvm;
+using namespace std;
+
+struct LoadedModule {
+    // Input file the module was parsed from
+    StringRef FileName;
+    // Context owning the module, NULL if parsing failed
+    LLVMContext *LLVMCtx;
+    Module *M;
+};
+
+/// Parse an IR file. In the lazy mode, function bodies are materialized
+/// one at a time and only the bodies of the functions that call MPI APIs
+/// are kept, so that memory scales with the MPI code rather than with the
+/// whole program. Bodies of modules without MPI declarations are never
+/// parsed.
+unique_ptr<Module> loadIRFile(const string &FileName, SMDiagnostic &Err,
+                              LLVMContext &Ctx, bool Lazy);
+
+/// Check whether a file may call an MPI API, reading only the symbol
+/// table of a bitcode file, or its string tables if the symbol table is
+/// missing or stale, so that modules that neither declare nor define an
+/// MPI API are never parsed.
+/// Files that are not bitcode, or that cannot be read, may.
+bool mayCallMPIAPI(const string &FileName);
+
+/// Peak resident set size of the process in bytes
+uint64_t getPeakRSS(void);
+
+/// Parse bitcode files on background threads, each into its own
+/// LLVMContext, and hand the modules out in input order as soon as they
+/// are ready. At most MaxQueued modules are parsed (or being parsed) but
+/// not yet taken by the consumer. With a memory limit, no module is
+/// parsed while the heap usage is above the limit, unless every module
+/// taken so far has been released and none is queued.
+class ModuleLoader {
+private:
+    const vector<string> &FileNames;
+    unsigned MaxQueued;
+    bool Lazy;
+    // Heap usage limit in bytes, 0 if unlimited
+    uint64_t MaxMemory;
+
+    vector<LoadedModule> Slots;
+    vector<bool> Ready;
+    unsigned NextToLoad;
+    unsigned NextToConsume;
+    // Modules taken but not released yet
+    unsigned InUse;
+    bool Stopping;
+
+    mutex Lock;
+    condition_variable CanLoad;
+    condition_variable Loaded;
+    vector<thread> Loaders;
+
+    bool hasMemoryForNext(void);
+
+    void loaderLoop(void);
+
+public:
+    ModuleLoader(const vector<string> &, unsigned NumThreads,
+                 unsigned MaxQueued, bool Lazy, uint64_t MaxMemory = 0);
+
+    ~ModuleLoader(void);
+
+    unsigned size(void) {
+        return FileNames.size();
+    }
+
+    /// Take the next module in input order, blocking until it is parsed.
+    /// Returns false once every input file has been handed out.
+    bool next(LoadedModule &);
+
+    /// Stop parsing files. The files not parsed yet are still handed out
+    /// by next(), without a module.
+    void stop(void);
+
+    /// Free a module taken with next() and its context
+    void release(LoadedModule &);
+};
+
+#endif
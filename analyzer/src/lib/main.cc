@@ -16,11 +16,17 @@
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Analysis/LoopInfo.h"
 
+#include "daemon.h"
 #include "global.h"
+#include "loader.h"
 #include "mpirace.h"
+#include "report.h"
+#include "shard.h"
+#include "stats.h"
+#include "summaryindex.h"
 
 cl::list<std::string> InputFileNames(
-    cl::Positional, cl::OneOrMore, cl::desc("<input bitcode files>"));
+    cl::Positional, cl::ZeroOrMore, cl::desc("<input bitcode files>"));
 
 cl::opt<unsigned> VerboseLevel(
     "verbose-level", cl::desc("Print information at which verbose level"),
@@ -31,30 +37,189 @@ cl::opt<bool> MPIRace(
     cl::desc("Detect data races in target MPI program"),
     cl::NotHidden, cl::init(false));
 
+cl::opt<unsigned> NumThreads(
+    "j", cl::desc("Number of threads used to detect data races"),
+    cl::value_desc("N"), cl::init(1));
+
+cl::opt<unsigned> SplitFunctionSize(
+    "split-function-size",
+    cl::desc("Analyze each nonblocking call of functions with at least "
+             "this many basic blocks as a separate task (with -j)"),
+    cl::init(500));
+
+cl::opt<bool> Dataflow(
+    "dataflow",
+    cl::desc("Check all the nonblocking calls of a function in one "
+             "forward dataflow pass over the function"),
+    cl::init(false));
+
+cl::opt<unsigned> MaxFunctionBlocks(
+    "max-function-blocks",
+    cl::desc("Cut the analysis of a function short after visiting this "
+             "many blocks over all its nonblocking calls (0 for no limit)"),
+    cl::value_desc("N"), cl::init(0));
+
+cl::opt<unsigned> MaxCallBlocks(
+    "max-call-blocks",
+    cl::desc("Cut the analysis of a nonblocking call short after visiting "
+             "this many blocks (0 for no limit)"),
+    cl::value_desc("N"), cl::init(0));
+
+cl::opt<double> FunctionTimeLimit(
+    "function-time-limit",
+    cl::desc("Cut the analysis of a function short after this many "
+             "seconds (0 for no limit)"),
+    cl::value_desc("seconds"), cl::init(0));
+
+cl::opt<double> CallTimeLimit(
+    "call-time-limit",
+    cl::desc("Cut the analysis of a nonblocking call short after this "
+             "many seconds (0 for no limit)"),
+    cl::value_desc("seconds"), cl::init(0));
+
+cl::opt<double> Deadline(
+    "deadline",
+    cl::desc("Stop analyzing this many seconds after the start, reporting "
+             "the functions analyzed so far, cheapest first within each "
+             "module, and listing the others (0 for no deadline)"),
+    cl::value_desc("seconds"), cl::init(0));
+
+cl::opt<bool> Interprocedural(
+    "interprocedural",
+    cl::desc("Summarize the functions of each module bottom-up over the "
+             "call graph and check calls of defined functions against "
+             "the summaries of the callees"),
+    cl::init(false));
+
+cl::opt<std::string> EmitSummary(
+    "emit-summary",
+    cl::desc("Write the summaries of the input module to this file for a "
+             "later -combine run (implies -interprocedural)"),
+    cl::value_desc("file"), cl::init(""));
+
+cl::opt<bool> Combine(
+    "combine",
+    cl::desc("Read summary files instead of bitcode files, combine the "
+             "summaries across the modules and re-analyze the modules "
+             "that call functions of other modules"),
+    cl::init(false));
+
+cl::opt<bool> LazyLoad(
+    "lazy-load",
+    cl::desc("Only keep the bodies of the functions that call MPI APIs "
+             "when parsing bitcode files (not with -interprocedural)"),
+    cl::init(false));
+
+cl::opt<bool> Preflight(
+    "preflight",
+    cl::desc("Skip bitcode files whose symbol table has no MPI API, "
+             "without parsing them (not with -interprocedural, "
+             "whose summaries cover every module)"),
+    cl::init(true));
+
+cl::opt<bool> Streaming(
+    "stream",
+    cl::desc("Parse, analyze and release one module at a time instead of "
+             "keeping all the modules in memory"),
+    cl::init(false));
+
+cl::opt<unsigned> Shards(
+    "shards",
+    cl::desc("Analyze the input files in this many worker processes, "
+             "isolating crashes to the shard of the worker"),
+    cl::value_desc("N"), cl::init(0));
+
+cl::opt<unsigned> MaxMemory(
+    "max-memory",
+    cl::desc("Do not parse more modules while the heap is larger than "
+             "this (with -stream, 0 for no limit)"),
+    cl::value_desc("MB"), cl::init(0));
+
+cl::opt<unsigned> LoadThreads(
+    "load-threads",
+    cl::desc("Parse input files on this many threads while analyzing "
+             "the modules already parsed (0 parses all files first)"),
+    cl::value_desc("N"), cl::init(0));
+
+cl::opt<unsigned> MaxQueuedModules(
+    "max-queued-modules",
+    cl::desc("Maximum number of parsed modules waiting for analysis "
+             "(with -load-threads)"),
+    cl::init(8));
+
+cl::opt<std::string> ResultCacheDir(
+    "cache-dir",
+    cl::desc("Cache the reports of analyzed functions in this directory "
+             "and reuse them for unchanged functions"),
+    cl::value_desc("dir"), cl::init(""));
+
+cl::opt<std::string> DaemonSocket(
+    "daemon",
+    cl::desc("Keep parsed modules and their reports in memory and serve "
+             "requests on this Unix socket, re-analyzing changed files "
+             "only (input files are analyzed up front)"),
+    cl::value_desc("socket"), cl::init(""));
+
+cl::opt<std::string> ClientSocket(
+    "client",
+    cl::desc("Send the input files to the daemon listening on this socket "
+             "and print its report"),
+    cl::value_desc("socket"), cl::init(""));
+
+cl::opt<bool> StopDaemon(
+    "stop-daemon", cl::desc("Stop the daemon (with -client)"),
+    cl::init(false));
+
+cl::opt<std::string> OutputFile(
+    "output",
+    cl::desc("Also write the races found to this file, one record per "
+             "race"),
+    cl::value_desc("file"), cl::init(""));
+
+cl::opt<ReportFormat> OutputFormat(
+    "format", cl::desc("Format of the -output file"),
+    cl::values(clEnumValN(JSONReport, "json", "JSON records"),
+               clEnumValN(SARIFReport, "sarif", "SARIF 2.1.0 log")),
+    cl::init(JSONReport));
+
+cl::opt<std::string> TraceFile(
+    "trace",
+    cl::desc("Write a Chrome trace of the parsing and analysis phases to "
+             "this file"),
+    cl::value_desc("file"), cl::init(""));
+
 GlobalContext GlobalCtx;
 
-void IterativeModulePass::run(ModuleList &modules) {
-    ModuleList::iterator i, e;
-    OP << "[" << ID << "] Initializing " << modules.size() << " modules ";
-    bool again = true;
-    while (again) {
-        again = false;
-        for (i = modules.begin(), e = modules.end(); i != e; ++i) {
-            again |= doInitialization(i->first);
-            OP << ".";
-        }
-    }
-    OP << "\n";
+/// List an input file that was not parsed or not analyzed because the
+/// deadline had passed
+static void reportSkippedFile(StringRef name) {
+    addCounter(SkippedFilesCounter);
+    OP << KYEL << "== Deadline reached, skipped file " << name << "\n"
+       << KNRM;
+}
 
-    unsigned iter = 0, changed = 1;
+bool IterativeModulePass::skipAtDeadline(StringRef name) {
+    if (!Ctx->isPastDeadline())
+        return false;
+    reportSkippedFile(name);
+    return true;
+}
+
+void IterativeModulePass::iterate(ModuleList &modules, unsigned iter,
+                                  unsigned changed) {
+    ModuleList::iterator i, e;
     while (changed) {
         ++iter;
         changed = 0;
         unsigned counter_modules = 0;
         unsigned total_modules = modules.size();
         for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+            ++counter_modules;
+            // Later iterations revisit modules that were analyzed
+            if (iter == 1 && skipAtDeadline(i->second))
+                continue;
             OP << "[" << ID << "/" << iter << "] "
-               << "[" << ++counter_modules << "/" << total_modules << "] "
+               << "[" << counter_modules << "/" << total_modules << "] "
                << "[" << i->second << "]\n";
 
             bool ret = doModulePass(i->first);
@@ -68,7 +233,7 @@ void IterativeModulePass::run(ModuleList &modules) {
     }
 
     OP << "[" << ID << "] Postprocessing...\n";
-    again = true;
+    bool again = true;
     while (again) {
         again = false;
         for (i = modules.begin(), e = modules.end(); i != e; ++i) {
@@ -80,18 +245,277 @@ void IterativeModulePass::run(ModuleList &modules) {
     OP << "[" << ID << "] Done!\n\n";
 }
 
+void IterativeModulePass::run(ModuleList &modules) {
+    ModuleList::iterator i, e;
+    OP << "[" << ID << "] Initializing " << modules.size() << " modules ";
+    bool again = true;
+    while (again) {
+        again = false;
+        for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+            again |= doInitialization(i->first);
+            OP << ".";
+        }
+    }
+    OP << "\n";
+
+    iterate(modules, 0, 1);
+}
+
+void IterativeModulePass::run(ModuleLoader &loader) {
+    ModuleList &modules = Ctx->Modules;
+    unsigned counter_modules = 0;
+    unsigned total_modules = loader.size();
+    unsigned changed = 0;
+    LoadedModule LM;
+
+    // The first iteration runs on each module as soon as it is parsed
+    while (loader.next(LM)) {
+        ++counter_modules;
+        // The files left are handed out without being parsed
+        if (skipAtDeadline(LM.FileName)) {
+            loader.stop();
+            loader.release(LM);
+            continue;
+        }
+        if (!LM.M) {
+            OP << "[" << ID << "] error loading file '"
+               << LM.FileName << "\n";
+            continue;
+        }
+
+        StringRef MName = LM.FileName;
+        modules.push_back(make_pair(LM.M, MName));
+        Ctx->ModuleMaps[LM.M] = LM.FileName;
+
+        while (doInitialization(LM.M))
+            ;
+
+        OP << "[" << ID << "/1] "
+           << "[" << counter_modules << "/" << total_modules << "] "
+           << "[" << MName << "]\n";
+
+        bool ret = doModulePass(LM.M);
+        if (ret) {
+            ++changed;
+            OP << "\t [Changed]\n";
+        } else
+            OP << "\n";
+    }
+    OP << "[" << ID << "] Updated in " << changed << " modules.\n";
+
+    iterate(modules, 1, changed);
+}
+
+void IterativeModulePass::runOnModule(Module *M, StringRef name,
+                                      unsigned index, unsigned total) {
+    while (doInitialization(M))
+        ;
+
+    // Iterate on the module alone until it no longer changes
+    unsigned iter = 0;
+    bool ret = true;
+    while (ret) {
+        OP << "[" << ID << "/" << ++iter << "] "
+           << "[" << index << "/" << total << "] "
+           << "[" << name << "]\n";
+        ret = doModulePass(M);
+        if (ret)
+            OP << "\t [Changed]\n";
+        else
+            OP << "\n";
+    }
+
+    while (doFinalization(M))
+        ;
+}
+
+void IterativeModulePass::stream(ModuleLoader &loader) {
+    unsigned counter_modules = 0;
+    unsigned total_modules = loader.size();
+    LoadedModule LM;
+
+    while (loader.next(LM)) {
+        ++counter_modules;
+        if (skipAtDeadline(LM.FileName)) {
+            loader.stop();
+            loader.release(LM);
+            continue;
+        }
+        if (!LM.M) {
+            OP << "[" << ID << "] error loading file '"
+               << LM.FileName << "\n";
+            continue;
+        }
+
+        runOnModule(LM.M, LM.FileName, counter_modules, total_modules);
+        loader.release(LM);
+    }
+
+    OP << "[" << ID << "] Done!\n\n";
+}
+
 int main(int argc, char **argv)
 {
     cl::ParseCommandLineOptions(argc, argv, "Data race detection\n");
 
+    if (!ClientSocket.empty())
+        return runDaemonClient(ClientSocket, InputFileNames, StopDaemon);
+    if (InputFileNames.empty() && DaemonSocket.empty()) {
+        OP << argv[0] << ": no input files\n";
+        return 1;
+    }
+
+    GlobalCtx.VerboseLevel = VerboseLevel;
+    GlobalCtx.TraceFile = TraceFile;
+    if (VerboseLevel > 0 || !TraceFile.empty())
+        enableStatistics(!TraceFile.empty());
+    GlobalCtx.NumThreads = NumThreads;
+    GlobalCtx.SplitFunctionSize = SplitFunctionSize;
+    GlobalCtx.DataflowMode = Dataflow;
+    GlobalCtx.Interprocedural = Interprocedural;
+    GlobalCtx.ResultCacheDir = ResultCacheDir;
+    GlobalCtx.MaxFunctionBlocks = MaxFunctionBlocks;
+    GlobalCtx.MaxCallBlocks = MaxCallBlocks;
+    GlobalCtx.FunctionTimeLimit = FunctionTimeLimit;
+    GlobalCtx.CallTimeLimit = CallTimeLimit;
+    if (Deadline > 0) {
+        GlobalCtx.HasDeadline = true;
+        GlobalCtx.Deadline =
+            chrono::steady_clock::now() +
+            chrono::duration_cast<chrono::steady_clock::duration>(
+                chrono::duration<double>(Deadline));
+    }
+
+    // Destroyed after the pass, which finishes the document
+    unique_ptr<ReportWriter> Reports;
+    if (!OutputFile.empty()) {
+        error_code EC;
+        Reports.reset(new ReportWriter(OutputFile, OutputFormat, EC));
+        if (EC) {
+            OP << argv[0] << ": cannot open '" << OutputFile << "': "
+               << EC.message() << "\n";
+            return 1;
+        }
+        GlobalCtx.Reports = Reports.get();
+    }
+
+    if (!EmitSummary.empty()) {
+        if (InputFileNames.size() != 1 || Combine) {
+            OP << argv[0] << ": -emit-summary takes one bitcode file\n";
+            return 1;
+        }
+        GlobalCtx.SummaryFile = EmitSummary;
+        GlobalCtx.Interprocedural = true;
+    }
+
+    // Only the streaming loader holds back the parsing of modules, and
+    // the daemon and the shards do not stream
+    if (MaxMemory > 0 &&
+        (!Streaming || !DaemonSocket.empty() || Shards > 1 || !MPIRace))
+        OP << "== -max-memory is ignored without -stream\n";
+
+    // Only the modules that depend on other modules are analyzed again,
+    // with the combined summaries of the functions they call
+    CombinedSummaryIndex Imports;
+    if (Combine) {
+        for (unsigned i = 0; i < InputFileNames.size(); ++i) {
+            string Error;
+            if (!Imports.addFile(InputFileNames[i], Error))
+                OP << argv[0] << ": error loading summary file '"
+                   << InputFileNames[i] << "': " << Error << "\n";
+        }
+        Imports.combine();
+        vector<string> Dependent;
+        Imports.getDependentModules(Dependent);
+        OP << "== Combined " << Imports.getNumSummaries()
+           << " summaries from " << Imports.getNumModules()
+           << " modules, re-examining " << Dependent.size()
+           << " module(s)\n";
+        InputFileNames.clear();
+        for (string &Path : Dependent)
+            InputFileNames.push_back(Path);
+        GlobalCtx.Imports = &Imports;
+        GlobalCtx.Interprocedural = true;
+    }
+
+    // Summaries need the bodies of the functions without MPI calls too
+    if (LazyLoad && GlobalCtx.Interprocedural) {
+        OP << argv[0] << ": -lazy-load cannot be used with -interprocedural, "
+           << "-emit-summary or -combine\n";
+        return 1;
+    }
+
     OP << "Total " << InputFileNames.size() << " file(s)\n";
+
+    // Functions of a module without MPI calls may still be called in the
+    // race window of another module, so summaries need every module
+    if (Preflight && MPIRace && !GlobalCtx.Interprocedural &&
+        DaemonSocket.empty()) {
+        vector<string> Kept;
+        for (unsigned i = 0; i < InputFileNames.size(); ++i) {
+            if (mayCallMPIAPI(InputFileNames[i]))
+                Kept.push_back(InputFileNames[i]);
+        }
+        if (Kept.size() < InputFileNames.size()) {
+            OP << "== Skipped " << InputFileNames.size() - Kept.size()
+               << " of " << InputFileNames.size()
+               << " file(s) without MPI references\n";
+            InputFileNames.clear();
+            for (string &File : Kept)
+                InputFileNames.push_back(File);
+        }
+    }
+
+    if (!DaemonSocket.empty()) {
+        if (Reports) {
+            OP << "== -output is ignored with -daemon\n";
+            GlobalCtx.Reports = NULL;
+        }
+        // The daemon outlives any deadline
+        if (GlobalCtx.HasDeadline) {
+            OP << "== -deadline is ignored with -daemon\n";
+            GlobalCtx.HasDeadline = false;
+        }
+        AnalysisDaemon Daemon(&GlobalCtx, DaemonSocket, LazyLoad);
+        if (!InputFileNames.empty())
+            Daemon.preload(InputFileNames);
+        return Daemon.serve() ? 0 : 1;
+    }
+
+    if (Shards > 1 && MPIRace)
+        return runShards(&GlobalCtx, InputFileNames, Shards, LazyLoad) ? 0 : 1;
+
+    // Keep only a bounded window of modules in memory
+    if (Streaming && MPIRace) {
+        ModuleLoader Loader(InputFileNames, LoadThreads ? LoadThreads : 1,
+                            MaxQueuedModules, LazyLoad,
+                            (uint64_t)MaxMemory << 20);
+        MPIRacePass MR(&GlobalCtx);
+        MR.stream(Loader);
+        OP << "== Peak RSS: " << (getPeakRSS() >> 20) << " MB\n";
+        return 0;
+    }
+
+    // Overlap parsing with the analysis
+    if (LoadThreads > 0 && MPIRace) {
+        ModuleLoader Loader(InputFileNames, LoadThreads, MaxQueuedModules,
+                            LazyLoad);
+        MPIRacePass MR(&GlobalCtx);
+        MR.run(Loader);
+        return 0;
+    }
     for (unsigned i = 0; i < InputFileNames.size(); ++i) {
+        if (MPIRace && GlobalCtx.isPastDeadline()) {
+            reportSkippedFile(InputFileNames[i]);
+            continue;
+        }
         LLVMContext *LLVMCtx = new LLVMContext();
         SMDiagnostic Err;
 
         //OP << "== loading bc file: " << InputFileNames[i] << "\n";
 
-        unique_ptr<Module> M = parseIRFile(InputFileNames[i], Err, *LLVMCtx);
+        unique_ptr<Module> M =
+            loadIRFile(InputFileNames[i], Err, *LLVMCtx, LazyLoad);
 
         if (M == NULL) {
             OP << argv[0] << ": error loading file '"
@@ -100,7 +524,7 @@ int main(int argc, char **argv)
         }
 
         Module *Module = M.release();
-        StringRef MName = StringRef(strdup(InputFileNames[i].data()));
+        StringRef MName = InputFileNames[i];
         GlobalCtx.Modules.push_back(make_pair(Module, MName));
         GlobalCtx.ModuleMaps[Module] = InputFileNames[i];
     }
@@ -0,0 +1,138 @@
+#include "mpiapi.h"
+
+using namespace llvm;
+
+/// The MPI APIs the analysis knows. A row gives, in order, the name, the
+/// kind, the direction of the buffer, the buffer, count and datatype
+/// arguments, those of the receive buffer, the request and the number of
+/// requests arguments, and what the call completes. Test calls are listed
+/// but not analyzed, since a test may leave its requests outstanding.
+static constexpr MPIAPISpec MPIAPISpecs[] = {
+    // Blocking point-to-point
+    {"MPI_Send", MPIBlockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, -1, -1, MPINoCompletion},
+    {"MPI_Bsend", MPIBlockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, -1, -1, MPINoCompletion},
+    {"MPI_Ssend", MPIBlockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, -1, -1, MPINoCompletion},
+    {"MPI_Rsend", MPIBlockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, -1, -1, MPINoCompletion},
+    {"MPI_Recv", MPIBlockingAPI, MPIBufferWrite,
+     0, 1, 2, -1, -1, -1, -1, -1, MPINoCompletion},
+    {"MPI_Mrecv", MPIBlockingAPI, MPIBufferWrite,
+     0, 1, 2, -1, -1, -1, -1, -1, MPINoCompletion},
+    {"MPI_Sendrecv", MPIBlockingAPI, MPIBufferRead,
+     0, 1, 2, 5, 6, 7, -1, -1, MPINoCompletion},
+    {"MPI_Sendrecv_replace", MPIBlockingAPI, MPIBufferReadWrite,
+     0, 1, 2, -1, -1, -1, -1, -1, MPINoCompletion},
+
+    // Nonblocking point-to-point
+    {"MPI_Isend", MPINonblockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, 6, -1, MPINoCompletion},
+    {"MPI_Ibsend", MPINonblockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, 6, -1, MPINoCompletion},
+    {"MPI_Issend", MPINonblockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, 6, -1, MPINoCompletion},
+    {"MPI_Irsend", MPINonblockingAPI, MPIBufferRead,
+     0, 1, 2, -1, -1, -1, 6, -1, MPINoCompletion},
+    {"MPI_Irecv", MPINonblockingAPI, MPIBufferWrite,
+     0, 1, 2, -1, -1, -1, 6, -1, MPINoCompletion},
+    {"MPI_Imrecv", MPINonblockingAPI, MPIBufferWrite,
+     0, 1, 2, -1, -1, -1, 4, -1, MPINoCompletion},
+
+    // Completion
+    {"MPI_Wait", MPIWaitAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 0, -1, MPICompleteOne},
+    {"MPI_Waitall", MPIWaitAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 1, 0, MPICompleteAll},
+    {"MPI_Waitany", MPIWaitAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 1, 0, MPICompleteAny},
+    {"MPI_Waitsome", MPIWaitAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 1, 0, MPICompleteSome},
+    {"MPI_Test", NotMPIAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 0, -1, MPICompleteIfFlag},
+    {"MPI_Testall", NotMPIAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 1, 0, MPICompleteIfFlag},
+    {"MPI_Testany", NotMPIAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 1, 0, MPICompleteIfFlag},
+    {"MPI_Testsome", NotMPIAPI, MPINoBuffer,
+     -1, -1, -1, -1, -1, -1, 1, 0, MPICompleteIfFlag},
+};
+
+static constexpr unsigned NumMPIAPIs =
+    sizeof(MPIAPISpecs) / sizeof(MPIAPISpecs[0]);
+
+// Number of slots of the hash table, a power of two
+static constexpr unsigned MPIAPITableSize = 64;
+
+static_assert(NumMPIAPIs < MPIAPITableSize, "MPI API table is too small");
+
+static constexpr size_t getNameLength(const char *Name) {
+    size_t Len = 0;
+    while (Name[Len])
+        ++Len;
+    return Len;
+}
+
+/// FNV-1a hash of a name, starting from a seed. The low bits FNV-1a
+/// leaves only depend on the low bits of the input, so the hash is mixed
+/// before they pick the slot.
+static constexpr uint32_t hashName(const char *Name, size_t Len,
+                                   uint32_t Seed) {
+    uint32_t Hash = 2166136261u ^ Seed;
+    for (size_t i = 0; i < Len; ++i) {
+        Hash ^= (unsigned char)Name[i];
+        Hash *= 16777619u;
+    }
+    Hash ^= Hash >> 16;
+    Hash *= 0x85ebca6bu;
+    Hash ^= Hash >> 13;
+    return Hash;
+}
+
+/// Index of the spec of each slot, -1 for empty slots
+struct MPIAPITable {
+    int8_t Slots[MPIAPITableSize];
+    bool Perfect;
+};
+
+static constexpr MPIAPITable buildTable(uint32_t Seed) {
+    MPIAPITable Table = {};
+    for (unsigned i = 0; i < MPIAPITableSize; ++i)
+        Table.Slots[i] = -1;
+    Table.Perfect = true;
+    for (unsigned i = 0; i < NumMPIAPIs; ++i) {
+        const char *Name = MPIAPISpecs[i].Name;
+        unsigned Slot = hashName(Name, getNameLength(Name), Seed) &
+                        (MPIAPITableSize - 1);
+        if (Table.Slots[Slot] >= 0)
+            Table.Perfect = false;
+        Table.Slots[Slot] = i;
+    }
+    return Table;
+}
+
+/// First seed for which no two names share a slot
+static constexpr uint32_t findSeed(void) {
+    for (uint32_t Seed = 0; Seed < 1024; ++Seed) {
+        if (buildTable(Seed).Perfect)
+            return Seed;
+    }
+    return ~0u;
+}
+
+static constexpr uint32_t MPIAPISeed = findSeed();
+
+static_assert(MPIAPISeed != ~0u,
+              "no perfect hash for the MPI API table, enlarge the table");
+
+static constexpr MPIAPITable MPIAPISlots = buildTable(MPIAPISeed);
+
+const MPIAPISpec *lookupMPIAPI(StringRef Name) {
+    unsigned Slot = hashName(Name.data(), Name.size(), MPIAPISeed) &
+                    (MPIAPITableSize - 1);
+    int Index = MPIAPISlots.Slots[Slot];
+    if (Index < 0 || !Name.equals(MPIAPISpecs[Index].Name))
+        return NULL;
+    return &MPIAPISpecs[Index];
+}
@@ -0,0 +1,69 @@
+#ifndef _MPIAPI_H_
+#define _MPIAPI_H_
+
+#include <cstdint>
+
+#include "llvm/ADT/StringRef.h"
+
+// Kinds of MPI APIs the analysis handles
+enum MPIAPIKind {
+    NotMPIAPI = 0,
+    MPINonblockingAPI,
+    MPIBlockingAPI,
+    MPIWaitAPI,
+};
+
+// How an MPI call accesses its buffer
+enum MPIBufferDirection {
+    MPINoBuffer = 0,
+    MPIBufferRead,
+    MPIBufferWrite,
+    // Sent and then overwritten by the received data
+    MPIBufferReadWrite,
+};
+
+// Which of its requests a wait or test call completes
+enum MPICompletion {
+    MPINoCompletion = 0,
+    MPICompleteOne,
+    MPICompleteAll,
+    MPICompleteAny,
+    MPICompleteSome,
+    // Completes the request only if a flag says so
+    MPICompleteIfFlag,
+};
+
+/// Argument positions and semantics of an MPI API, -1 for arguments the
+/// API does not have. A call with a second buffer, e.g., MPI_Sendrecv,
+/// reads the first one and writes the second one.
+struct MPIAPISpec {
+    const char *Name;
+    MPIAPIKind Kind;
+    MPIBufferDirection Direction;
+    int8_t Buffer;
+    int8_t Count;
+    int8_t Datatype;
+    int8_t RecvBuffer;
+    int8_t RecvCount;
+    int8_t RecvDatatype;
+    // The request, or the array of requests of a wait call
+    int8_t Request;
+    // Number of requests in the array of requests
+    int8_t RequestCount;
+    MPICompletion Completion;
+
+    bool isBufferWrite(void) const {
+        return Direction == MPIBufferWrite || Direction == MPIBufferReadWrite;
+    }
+
+    bool hasRecvBuffer(void) const {
+        return RecvBuffer >= 0;
+    }
+};
+
+/// Get the specification of an MPI API, NULL if the name is not one.
+/// Takes constant time: names are hashed into a table laid out at compile
+/// time without collisions.
+extern const MPIAPISpec *lookupMPIAPI(llvm::StringRef);
+
+#endif
@@ -3,19 +3,42 @@
 
 #include "mpicall.h"
 #include "mpirace.h"
+#include "report.h"
+#include "stats.h"
+
+/// Check whether a number of requests is the constant 1. Reading the
+/// constant is thread-safe unlike creating one.
+static bool isConstantOne(Value *V) {
+    ConstantInt *C = dyn_cast<ConstantInt>(V);
+    return C && C->getValue().getZExtValue() == 1;
+}
+
+/// Get the buffer argument of an MPI call, looking through a cast
+static Value *getBufferOperand(CallBase *CI, int Arg) {
+    Value *Buffer = CI->getArgOperand(Arg);
+    if (BitCastInst *BCI = dyn_cast<BitCastInst>(Buffer))
+        return BCI->getOperand(0);
+    return Buffer;
+}
 
-MPIWaitCall::MPIWaitCall(CallBase *CI) {
+MPIWaitCall::MPIWaitCall(CallBase *CI, const CallSummary *S) {
     MPICallInst = CI;
     APIName = CI->getCalledFunction()->getName();
-    if (APIName.equals("MPI_Wait")) {
-        WaitCount = ConstantInt::get(Type::getInt32Ty(CI->getContext()), 1);
-        MPIRequest = CI->getArgOperand(0);
-    } else if (APIName.equals("MPI_Waitall")) {
-        WaitCount = CI->getArgOperand(0);
-        MPIRequest = CI->getArgOperand(1);
-    } else if (APIName.equals("MPI_Waitany")) {
-        WaitCount = ConstantInt::get(Type::getInt32Ty(CI->getContext()), 1);
-        MPIRequest = CI->getArgOperand(1);
+    SingleRequest = true;
+    const MPIAPISpec *Spec = lookupMPIAPI(APIName);
+    if (Spec && Spec->Kind == MPIWaitAPI) {
+        MPIRequest = CI->getArgOperand(Spec->Request);
+        // The requests of an array are matched one by one, unless all of
+        // them complete and there is only one
+        if (Spec->Completion == MPICompleteAll)
+            SingleRequest = isConstantOne(CI->getArgOperand(Spec->RequestCount));
+    } else if (S && S->getKind() == MPIWaitAPI) {
+        // A call to a function completing a request parameter
+        const SummaryWait &SW = S->Completed[0];
+        SingleRequest = SW.CountParam >= 0
+                            ? isConstantOne(CI->getArgOperand(SW.CountParam))
+                            : SW.Single;
+        MPIRequest = CI->getArgOperand(SW.RequestParam);
     } else
         OP << "Unsupported wait call\n";
 }
@@ -31,58 +54,32 @@ CallBase *MPIWaitCall::getMPICallInst(void) {
    return MPICallInst;
 }
 
-/// Check whether the input MPIRequest matches with this Wait call
-bool MPIWaitCall::isMatchedMPIRequest(Value *MR) {
-    if (ConstantInt *CI = dyn_cast<ConstantInt>(WaitCount)) {
-        uint64_t WCValue = CI->getValue().getZExtValue();
-        if (WCValue == 1 && MPIRequest == MR)
-            return true;
-    }
-
-    if (GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(MR)) {
-        Value *MRPtr= GEPI->getPointerOperand();
-        if (GetElementPtrInst *MGEPI = dyn_cast<GetElementPtrInst>(MPIRequest)) {
-            if (MGEPI->getPointerOperand() == MRPtr) {
-                //TODO: more accurate analysis is required here
-                return true;
-            }
-        }
-        if (isLoadFromSameAddr(MPIRequest, MRPtr))
-            return true;
-    }
-
-    if (GetElementPtrInst *MGEPI = dyn_cast<GetElementPtrInst>(MPIRequest)) {
-        Value *MGEPIPtr = MGEPI->getPointerOperand();
-        if (isLoadFromSameAddr(MGEPIPtr, MR))
-            return true;
-    }
-
-    if (CallBase *MRCB = dyn_cast<CallBase>(MR)) {
-        if (CallBase *MPCB = dyn_cast<CallBase>(MPIRequest)) {
-            if (isCPPSTLAPI(MRCB->getCalledFunction()->getName()) &&
-                isCPPSTLAPI(MPCB->getCalledFunction()->getName())) {
-                if (MRCB->getArgOperand(0) == MPCB->getArgOperand(0))
-                    return true;
-            }
-        }
-    }
+Value *MPIWaitCall::getMPIRequest(void) {
+    return MPIRequest;
+}
 
-    OP << KYEL << "\n== Unsupported types when matching MPI request ==\n"
-       << "== MPIRequest: " << *MPIRequest << "\n"
-       << "== MR: " << *MR << "\n" << KNRM;
-    return false; 
+/// Check whether this wait call completes a single request
+bool MPIWaitCall::isSingleRequest(void) {
+    return SingleRequest;
 }
 
 MPIBlockingCall::MPIBlockingCall(CallBase *CI) {
     MPICallInst = CI;
     APIName = CI->getCalledFunction()->getName();
-    if (APIName.equals("MPI_Send") ||
-        APIName.equals("MPI_Recv")) {
-        BufferStart = CI->getArgOperand(0);
-        if (BitCastInst *BCI = dyn_cast<BitCastInst>(BufferStart))
-            BufferStart = BCI->getOperand(0);
-        BufferAccessSize = parseAccessSize(CI->getArgOperand(1), CI->getArgOperand(2));
-        isWrite = isMPIWriteAPI(APIName);
+    RecvBufferStart = NULL;
+    RecvBufferAccessSize = 0;
+    const MPIAPISpec *Spec = lookupMPIAPI(APIName);
+    if (Spec && Spec->Kind == MPIBlockingAPI) {
+        BufferStart = getBufferOperand(CI, Spec->Buffer);
+        BufferAccessSize = parseAccessSize(CI->getArgOperand(Spec->Count),
+                                           CI->getArgOperand(Spec->Datatype));
+        isWrite = Spec->isBufferWrite();
+        if (Spec->hasRecvBuffer()) {
+            RecvBufferStart = getBufferOperand(CI, Spec->RecvBuffer);
+            RecvBufferAccessSize = parseAccessSize(
+                CI->getArgOperand(Spec->RecvCount),
+                CI->getArgOperand(Spec->RecvDatatype));
+        }
     } else
         OP << "== Error: Unsupport MPI nonblocking call: " << APIName << "\n";
 }
@@ -98,18 +95,37 @@ uint64_t MPIBlockingCall::getBufferAccessSize(void) {
     return BufferAccessSize;
 }
 
-MPINonblockingCall::MPINonblockingCall(MPIRacePass *MP, CallBase *CI) {
-    MPass = MP;
+bool MPIBlockingCall::isBufferWrite(void) {
+    return isWrite;
+}
+
+MPINonblockingCall::MPINonblockingCall(FunctionContext *FC, CallBase *CI) {
+    FCtx = FC;
     MPICallInst = CI;
+    SummaryBuffer = NULL;
+    CoversAllPaths = true;
     APIName = CI->getCalledFunction()->getName();
-    if (APIName.equals("MPI_Isend") || APIName.equals("MPI_Irsend") ||
-        APIName.equals("MPI_Irecv")) {
-        BufferStart = CI->getArgOperand(0);
+    const CallSummary *S = FCtx->getCalleeSummary(CI);
+    const MPIAPISpec *Spec = lookupMPIAPI(APIName);
+    if (Spec && Spec->Kind == MPINonblockingAPI) {
+        BufferStart = getBufferOperand(CI, Spec->Buffer);
+        BufferAccessSize = parseAccessSize(CI->getArgOperand(Spec->Count),
+                                           CI->getArgOperand(Spec->Datatype));
+        MPIRequest = CI->getArgOperand(Spec->Request);
+        isWrite = Spec->isBufferWrite();
+    } else if (S && S->getKind() == MPINonblockingAPI) {
+        // A call to a function starting a request that is still
+        // outstanding when it returns
+        const SummaryRequest &SR = S->Started[0];
+        SummaryBuffer = &SR.Buffer;
+        BufferStart = SR.Buffer.Param < 0
+                          ? CI->getModule()->getNamedGlobal(SR.Buffer.Global)
+                          : CI->getArgOperand(SR.Buffer.Param);
         if (BitCastInst *BCI = dyn_cast<BitCastInst>(BufferStart))
             BufferStart = BCI->getOperand(0);
-        BufferAccessSize = parseAccessSize(CI->getArgOperand(1), CI->getArgOperand(2));
-        MPIRequest = CI->getArgOperand(6);
-        isWrite = isMPIWriteAPI(APIName);
+        BufferAccessSize = SR.Buffer.Size;
+        MPIRequest = CI->getArgOperand(SR.RequestParam);
+        isWrite = SR.Buffer.IsWrite;
     } else
         OP << "== Error: Unsupport MPI nonblocking call: " << APIName << "\n";
 }
@@ -120,11 +136,19 @@ MPINonblockingCall::~MPINonblockingCall(void) {
 void MPINonblockingCall::dumpInfo(void) {
     OP << "\n== Nonblocking call: " << *MPICallInst << "\n";
     OP << "== Corresponding wait call (" << MPIWaitCalls.size() << "): \n";
-    for (set<MPIWaitCall *>::iterator it = MPIWaitCalls.begin(), ie = MPIWaitCalls.end();
-         it != ie; ++it) {
+    for (SetVector<MPIWaitCall *>::iterator it = MPIWaitCalls.begin(),
+         ie = MPIWaitCalls.end(); it != ie; ++it) {
         MPIWaitCall *WC = *it;
         WC->dumpInfo();
     }
+    if (MPIWaitCalls.empty() || CoversAllPaths)
+        return;
+    OP << "== Request may leave the function without a wait call";
+    for (unsigned i = 0; i < EscapePoints.size(); ++i) {
+        OP << (i ? ", " : " after ");
+        EscapePoints[i]->printAsOperand(OP, false);
+    }
+    OP << "\n";
 }
 
 CallBase *MPINonblockingCall::getMPICallInst(void) {
@@ -151,56 +175,143 @@ void MPINonblockingCall::addWaitCall(MPIWaitCall *WC) {
     MPIWaitCalls.insert(WC);
 }
 
-bool MPINonblockingCall::isWantedWaitCall(Instruction *I,
-                                       map<CallBase *, MPIWaitCall *> &WCalls) {
-    CallBase *CI = dyn_cast<CallBase>(I);
-    if (!CI)
-        return false;
-    Function *Callee = CI->getCalledFunction();
-    if (!Callee)
-        return false;
-    StringRef CalleeName = Callee->getName();
-    if (isMPIWaitAPI(CalleeName)) {
-        MPIWaitCall *WC;
-        if (WCalls.count(CI) > 0)
-            WC = WCalls[CI];
-        else
-            OP << "Error, cannot get wait call for: " << *CI << "\n";
-        return WC->isMatchedMPIRequest(MPIRequest);
+/// Check whether a wait call completes the request of this call. Wait
+/// calls that do not are reported once per nonblocking call.
+bool MPINonblockingCall::isWantedWaitCall(MPIWaitCall *WC,
+                                       SmallPtrSetImpl<MPIWaitCall *> &Matching,
+                                       SmallPtrSetImpl<MPIWaitCall *> &Reported) {
+    if (Matching.count(WC))
+        return true;
+    if (Reported.insert(WC).second)
+        OP << KYEL << "\n== Unsupported types when matching MPI request ==\n"
+           << "== MPIRequest: " << *WC->getMPIRequest() << "\n"
+           << "== MR: " << *MPIRequest << "\n" << KNRM;
+    return false;
+}
+
+/// Check whether a block is reachable from another block through at
+/// least one edge, e.g., from itself through a loop
+static bool isReachableFrom(ReachabilityIndex *RC, BasicBlock *Src,
+                            BasicBlock *Dst) {
+    Instruction *TI = Src->getTerminator();
+    for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
+        if (RC->isReachable(TI->getSuccessor(i), Dst))
+            return true;
     }
     return false;
 }
 
+/// Find the wait call completing the request on every path with tree
+/// queries: the first wait call of the nearest post-dominator with wait
+/// calls, if it matches and no other wait call is reachable from this
+/// call before it. Any such wait call would be in a block the
+/// post-dominator post-dominates. Otherwise the search decides.
+bool MPINonblockingCall::findPostDominatingWait(
+        SmallPtrSetImpl<MPIWaitCall *> &Matching) {
+    PostDominanceIndex *PD = FCtx->PostDoms;
+    ReachabilityIndex *RC = FCtx->Reachability;
+    MPIRequestIndex *RI = FCtx->Requests;
+    BasicBlock *BB = MPICallInst->getParent();
+
+    BasicBlock *PDom = PD->getIPostDom(BB);
+    while (PDom && RI->getWaitCallsInBlock(PDom).empty())
+        PDom = PD->getIPostDom(PDom);
+    if (!PDom || !Matching.count(RI->getWaitCallsInBlock(PDom)[0]))
+        return false;
+
+    unsigned Pos = RI->getPosition(MPICallInst);
+    for (DenseMap<CallBase *, MPIWaitCall *>::iterator
+           it = FCtx->WCalls.begin(), ie = FCtx->WCalls.end();
+         it != ie; ++it) {
+        BasicBlock *WaitBB = it->first->getParent();
+        if (WaitBB == PDom || !PD->postDominates(PDom, WaitBB))
+            continue;
+        // Wait calls after this call in its block were checked already
+        if (WaitBB == BB && RI->getPosition(it->first) > Pos)
+            continue;
+        if (isReachableFrom(RC, BB, WaitBB))
+            return false;
+    }
+
+    addWaitCall(RI->getWaitCallsInBlock(PDom)[0]);
+    return true;
+}
+
+/// Record how the request may leave the function without completing:
+/// the exits the search reached, and the branches in the post-dominance
+/// frontiers of the wait calls from which control avoids them
+void MPINonblockingCall::computeEscapes(BitVector &Visited) {
+    ReachabilityIndex *RC = FCtx->Reachability;
+    BasicBlock *BB = MPICallInst->getParent();
+    auto IsEscape = [](BasicBlock *Exit) {
+        // Unreachable ends, e.g., after MPI_Abort, complete nothing
+        Instruction *TI = Exit->getTerminator();
+        return TI->getNumSuccessors() == 0 && !isa<UnreachableInst>(TI);
+    };
+    auto InWindow = [&](BasicBlock *Block) {
+        return Block == BB || Visited.test(RC->getBlockId(Block));
+    };
+
+    bool Escapes = IsEscape(BB);
+    for (unsigned Id = Visited.find_first(); !Escapes && Id != -1U;
+         Id = Visited.find_next(Id))
+        Escapes = IsEscape(RC->getBlock(Id));
+    CoversAllPaths = !Escapes;
+    if (CoversAllPaths)
+        return;
+
+    for (MPIWaitCall *WC : MPIWaitCalls) {
+        BasicBlock *WaitBB = WC->getMPICallInst()->getParent();
+        for (BasicBlock *Branch : FCtx->PostDoms->getFrontier(WaitBB)) {
+            if (InWindow(Branch) && !is_contained(EscapePoints, Branch))
+                EscapePoints.push_back(Branch);
+        }
+    }
+}
+
 /// Identify the MPI_Wait call(s) that correspond to
 /// this non-blocking call
-void MPINonblockingCall::identifyWaitCalls(map<CallBase *, MPIWaitCall *> &WCalls) {
-    // Check instructions in the current block
-    Instruction *prevInsn = MPICallInst;
-    while (Instruction *curInsn = prevInsn->getNextNonDebugInstruction()) {
-        if (isWantedWaitCall(curInsn, WCalls)) {
-            addWaitCall(WCalls[dyn_cast<CallBase>(curInsn)]);
+void MPINonblockingCall::identifyWaitCalls(void) {
+    MPIRequestIndex *RI = FCtx->Requests;
+    SmallPtrSet<MPIWaitCall *, 4> Matching;
+    SmallPtrSet<MPIWaitCall *, 4> Reported;
+    RI->getMatchingWaitCalls(MPIRequest, Matching);
+    CoversAllPaths = true;
+
+    // Check wait calls after this call in the current block
+    BasicBlock *BB = MPICallInst->getParent();
+    unsigned Pos = RI->getPosition(MPICallInst);
+    for (MPIWaitCall *WC : RI->getWaitCallsInBlock(BB)) {
+        if (RI->getPosition(WC->getMPICallInst()) <= Pos)
+            continue;
+        if (isWantedWaitCall(WC, Matching, Reported)) {
+            addWaitCall(WC);
             return;
         }
-        prevInsn = curInsn;
     }
 
-    // Check instructions in the successor blocks
-    BasicBlock *BB = MPICallInst->getParent();
-    set<BasicBlock *> visitedBBs;
-    list<BasicBlock *> toBeVisitedBBs;
+    if (findPostDominatingWait(Matching))
+        return;
+
+    // Check wait calls in the successor blocks
+    ReachabilityIndex *RC = FCtx->Reachability;
+    BitVector visitedBBs(RC->getNumBlocks());
+    SmallVector<BasicBlock *, 32> toBeVisitedBBs;
+    uint64_t NumVisited = 0;
     addSuccessorBlocks(BB, toBeVisitedBBs);
-    while (!toBeVisitedBBs.empty()) {
-        BasicBlock *curBB = toBeVisitedBBs.front();
-        toBeVisitedBBs.pop_front();
-        if (visitedBBs.count(curBB) != 0)
+    for (unsigned i = 0; i < toBeVisitedBBs.size(); ++i) {
+        BasicBlock *curBB = toBeVisitedBBs[i];
+        unsigned Id = RC->getBlockId(curBB);
+        if (visitedBBs.test(Id))
             continue;
-        visitedBBs.insert(curBB);
+        visitedBBs.set(Id);
+        ++NumVisited;
+        if (!Budget.charge())
+            break;
         bool found = false;
-        for (BasicBlock::iterator it = curBB->begin(), ie = curBB->end();
-             it != ie; ++it) {
-            Instruction *I = &*it;
-            if (isWantedWaitCall(I, WCalls)) {
-                addWaitCall(WCalls[dyn_cast<CallBase>(I)]);
+        for (MPIWaitCall *WC : RI->getWaitCallsInBlock(curBB)) {
+            if (isWantedWaitCall(WC, Matching, Reported)) {
+                addWaitCall(WC);
                 found = true;
                 break;
             }
@@ -209,236 +320,298 @@ void MPINonblockingCall::identifyWaitCalls(map<CallBase *, MPIWaitCall *> &WCall
             continue;
         addSuccessorBlocks(curBB, toBeVisitedBBs);
     }
+    addCounter(VisitedBlocksCounter, NumVisited);
+    // Paths the search did not finish are not known to escape
+    if (!Budget.isExhausted())
+        computeEscapes(visitedBBs);
 }
 
-bool MPINonblockingCall::checkBufferOverlap(Value *Ptr, uint64_t AccessSize) {
-    if (Ptr == NULL)
-        return false;
-
-    //OP << "== Ptr: " << *Ptr << ", AccessSize: " << AccessSize << "\n"
-    //   << "== BufferStart: " << *BufferStart
-    //   << ", BufferAccessSize: " << BufferAccessSize << "\n";
+SetVector<MPIWaitCall *> &MPINonblockingCall::getWaitCalls(void) {
+    return MPIWaitCalls;
+}
 
-    GetElementPtrInst *PtrGEPI = dyn_cast<GetElementPtrInst>(Ptr);
-    GetElementPtrInst *BSGEPI = dyn_cast<GetElementPtrInst>(BufferStart);
-    if (PtrGEPI && BSGEPI) {
-        unsigned OpdNum = PtrGEPI->getNumOperands();
-        if (BSGEPI->getNumOperands() != OpdNum)
+/// Check whether the buffer accessed by an instruction needs to be
+/// checked against the buffer of this call
+bool MPINonblockingCall::mayConflict(Instruction *I) {
+    if (isWrite) {
+        // Nonblocking call is a write, so we need to check read and write.
+        // We also need to check other MPI calls.
+        if (isa<LoadInst>(I) || isa<StoreInst>(I))
+            return true;
+        CallBase *CI = dyn_cast<CallBase>(I);
+        if (!CI)
             return false;
-        for (unsigned i = 1; i < OpdNum; ++i) {
-            Value *Opd0 = PtrGEPI->getOperand(i);
-            Value *Opd1 = BSGEPI->getOperand(i);
-            if (Opd0 == Opd1)
-                continue;
-            ConstantInt *CI0 = dyn_cast<ConstantInt>(Opd0);
-            ConstantInt *CI1 = dyn_cast<ConstantInt>(Opd1);
-            if (CI0 && CI1 && AccessSize != 0 &&
-                BufferAccessSize != 0) {
-                uint64_t Val0 = CI0->getValue().getZExtValue();
-                uint64_t Val1 = CI1->getValue().getZExtValue();
-                if ((Val0 <= Val1 &&
-                     Val1 + BufferAccessSize <= Val0 + AccessSize) ||
-                     (Val1 <= Val0 &&
-                     Val0 + AccessSize <= Val1 + BufferAccessSize))
-                    continue;
+        if (CI == MPICallInst) {
+            // This is a call in a loop. Let's check whether the accessed
+            // buffer address is loop invariant.
+            if (GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(BufferStart)) {
+                // TODO: more accurate analysis to avoid false negatives
+                // caused by overlapped buffer accesses across loop iterations
+                if (!isConstantIdx(GEPI))
+                    return false;
             }
-            //TODO: more accurate analysis is required to avoid
-            // potential false negatives.
-            return false;
-        }
-        Value *PO1 = PtrGEPI->getPointerOperand();
-        Value *PO2 = BSGEPI->getPointerOperand();
-        if (PO1 == PO2)
-            return true;
-        GetElementPtrInst *POGEP1 = dyn_cast<GetElementPtrInst>(PO1);
-        GetElementPtrInst *POGEP2 = dyn_cast<GetElementPtrInst>(PO2);
-        if (POGEP1 && POGEP2) {
-            OpdNum = POGEP1->getNumOperands();
-            if (POGEP2->getNumOperands() != OpdNum)
-                return false;
-            for (unsigned i = 0; i < OpdNum; ++i) {
-                if (POGEP1->getOperand(i) != POGEP2->getOperand(i))
+            CallBase *CB = dyn_cast<CallBase>(BufferStart);
+            if (CB && isCPPSTLAPI(CB->getCalledFunction()->getName())) {
+                Value *Idx = CB->getArgOperand(1);
+                // TODO: more accurate analysis to avoid false negatives in
+                // C++ programs
+                if (!dyn_cast<ConstantInt>(Idx))
                     return false;
             }
         }
+        if (FCtx->getNonblockingCall(CI) || FCtx->getBlockingCall(CI))
+            return true;
+        const CallSummary *S = FCtx->getCalleeSummary(CI);
+        return S && S->mayAccess(false);
     }
 
-    set<Value *> PtrRootPtrs;
-    set<Value *> BufferStartRootPtrs;
-    collectRootPointers(Ptr, PtrRootPtrs);
-    collectRootPointers(BufferStart, BufferStartRootPtrs);
-
-    for (set<Value *>::iterator it = PtrRootPtrs.begin(), ie = PtrRootPtrs.end();
-         it != ie; ++it) {
-        Value *V = *it;
-        if (dyn_cast<ConstantPointerNull>(V))
-            continue;
-        if (BufferStartRootPtrs.count(V) > 0) {
-            //OP << "== Ptr: " << *Ptr << ", AccessSize: " << AccessSize << "\n"
-            //   << "== BufferStart: " << *BufferStart
-            //   << ", BufferAccessSize: " << BufferAccessSize << "\n"
-            //   << "== V: " << *V << "\n";
+    // Nonblocking call is a read, so we only need to check write
+    if (isa<StoreInst>(I))
+        return true;
+    if (CallBase *CI = dyn_cast<CallBase>(I)) {
+        MPINonblockingCall *TempCall = FCtx->getNonblockingCall(CI);
+        if (TempCall && TempCall->isBufferWrite())
             return true;
-        }
+        // e.g., MPI_Sendrecv or MPI_Sendrecv_replace
+        MPIBlockingCall *BC = FCtx->getBlockingCall(CI);
+        if (BC && (BC->getRecvBufferStart() || BC->isBufferWrite()))
+            return true;
+        const CallSummary *S = FCtx->getCalleeSummary(CI);
+        return S && S->mayAccess(true);
     }
-
-    // TODO: check potential overlaps
-
     return false;
 }
 
-void MPINonblockingCall::checkInstruction(Instruction *I) {
-    Value *Ptr = NULL;
-    uint64_t AccessSize = 0;
+/// Add the buffer access of an instruction that may conflict with the
+/// buffer of this call to the accesses of the race window
+void MPINonblockingCall::collectAccess(Instruction *I,
+                                       BufferOverlapIndex &Accesses) {
+    if (!mayConflict(I))
+        return;
+    // A call of a summarized function accesses what its summary does
+    if (const CallSummary *S = FCtx->getCalleeSummary(I)) {
+        SmallVector<BufferAccess, 4> CallAccesses;
+        S->getCallAccesses(cast<CallBase>(I), Accesses.getLayout(),
+                           CallAccesses);
+        for (BufferAccess &A : CallAccesses)
+            Accesses.addAccess(A);
+        return;
+    }
+    Value *Ptr;
+    uint64_t AccessSize;
+    bool IsAccessWrite;
+    for (unsigned i = 0;
+         FCtx->getBufferAccess(I, Ptr, AccessSize, IsAccessWrite, i); ++i)
+        Accesses.addAccess(I, Ptr, AccessSize, IsAccessWrite);
+}
 
-    if (isWrite) {
-        // Nonblocking call is a write, so we need to check read and write.
-        // We also need to check other MPI calls.
-        if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
-            Ptr = LI->getPointerOperand();
-            AccessSize = getAccessSizeFromPointerType(LI->getPointerOperandType());
-        } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
-            Ptr = SI->getPointerOperand();
-            AccessSize = getAccessSizeFromPointerType(SI->getPointerOperandType());
-        } else if (CallBase *CI = dyn_cast<CallBase>(I)) {
-            if (CI == MPICallInst) {
-                // This is a call in a loop. Let's check whether the accessed
-                // buffer address is loop invariant.
-                if (GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(BufferStart)) {
-                    // TODO: more accurate analysis to avoid false negatives
-                    // caused by overlapped buffer accesses across loop iterations
-                    if (!isConstantIdx(GEPI))
-                        return;
-                }
-                CallBase *CB = dyn_cast<CallBase>(BufferStart);
-                if (CB && isCPPSTLAPI(CB->getCalledFunction()->getName())) {
-                    Value *Idx = CB->getArgOperand(1);
-                    // TODO: more accurate analysis to avoid false negatives in
-                    // C++ programs
-                    if (!dyn_cast<ConstantInt>(Idx))
-                        return;
-                }
-            }
-            MPINonblockingCall *TempNBCall = MPass->getNonblockingCall(CI);
-            if (TempNBCall) {
-                Ptr = TempNBCall->getBufferStart();
-                AccessSize = TempNBCall->getBufferAccessSize();
-            }
-            MPIBlockingCall *TempBCall = MPass->getBlockingCall(CI);
-            if (TempBCall) {
-                Ptr = TempBCall->getBufferStart();
-                AccessSize = TempBCall->getBufferAccessSize();
-            }
-        }
-    } else {
-        // Nonblocking call is a read, so we only need to check write
-        if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
-            Ptr = SI->getPointerOperand();
-            AccessSize = getAccessSizeFromPointerType(SI->getPointerOperandType());
-        } else if (CallBase *CI = dyn_cast<CallBase>(I)) {
-            MPINonblockingCall *TempCall = MPass->getNonblockingCall(CI);
-            if (TempCall && TempCall->isBufferWrite()) {
-                Ptr = TempCall->getBufferStart();
-                AccessSize = TempCall->getBufferAccessSize();
-            }
-        }
+/// Position of the first wait call of this call in a block from the
+/// position From on, ~0U if there is none
+unsigned MPINonblockingCall::getWaitPosition(BasicBlock *BB, unsigned From) {
+    MPIRequestIndex *RI = FCtx->Requests;
+    for (MPIWaitCall *WC : RI->getWaitCallsInBlock(BB)) {
+        unsigned Pos = RI->getPosition(WC->getMPICallInst());
+        if (Pos >= From && MPIWaitCalls.count(WC))
+            return Pos;
     }
-    if (checkBufferOverlap(Ptr, AccessSize)) {
-        OP << KGRN << "== Found a data race:\n"
-           KMAG << "   ==" << *MPICallInst << "\n"
-           KYEL << "       == " << getSourceLine(MPICallInst) << "\n"
-           KMAG << "   ==" << *I << "\n"
-           KYEL << "       == " << getSourceLine(I) << "\n" << KNRM;
+    return ~0U;
+}
+
+/// Add the accesses of a block between the positions From and To that
+/// may conflict with the buffer of this call. Loads and stores come from
+/// the summary of the block, and are skipped as a whole when its filter
+/// rules out the buffer.
+void MPINonblockingCall::collectBlockAccesses(unsigned Block, unsigned From,
+                                              unsigned To,
+                                              const AccessQuery &Query,
+                                              BufferOverlapIndex &Accesses) {
+    BlockAccessTable *BA = FCtx->BlockAccesses;
+    bool MayMatch = BA->mayMatchBlock(Block, Query);
+    if (!MayMatch && !BA->hasCalls(Block))
+        return;
+    unsigned Begin, End;
+    BA->getRows(Block, Begin, End);
+    SmallVector<uint8_t, 64> Match;
+    if (MayMatch)
+        BA->matchRows(Begin, End, Query, Match);
+    else
+        Match.assign(End - Begin, 0);
+
+    for (unsigned r = Begin; r < End; ++r) {
+        unsigned Pos = BA->getPosition(r);
+        if (Pos < From)
+            continue;
+        if (Pos >= To)
+            break;
+        uint8_t Flags = BA->getFlags(r);
+        if (Flags & BlockAccessTable::CallFlag) {
+            collectAccess(BA->getInst(r), Accesses);
+            continue;
+        }
+        // Loads only conflict with a buffer written by this call
+        if (!Match[r - Begin] ||
+            (!isWrite && !(Flags & BlockAccessTable::WriteFlag)))
+            continue;
+        BufferAccess A;
+        BA->getAccess(r, A);
+        Accesses.addAccess(A);
     }
 }
 
-bool MPINonblockingCall::isWaitCallOfThisNonblockingCall(Instruction *I) {
-    for (set<MPIWaitCall *>::iterator it = MPIWaitCalls.begin(), ie = MPIWaitCalls.end();
-         it != ie; ++it) {
-        MPIWaitCall *WC = *it;
-        if (WC->getMPICallInst() == I)
-            return true;
+/// Get the successor block of this call that is only taken if the call
+/// fails, i.e., the call result is compared unequal to zero
+BasicBlock *MPINonblockingCall::getSkippedSuccessor(void) {
+    Instruction *TI = MPICallInst->getParent()->getTerminator();
+    BranchInst *BI = dyn_cast<BranchInst>(TI);
+    if (!BI || !BI->isConditional())
+        return NULL;
+    CmpInst *CI = dyn_cast<CmpInst>(BI->getCondition());
+    if (!CI || CI->getPredicate() != CmpInst::ICMP_NE)
+        return NULL;
+    bool remove = false;
+    if (CI->getOperand(0) == MPICallInst) {
+        ConstantInt *Opd1 = dyn_cast<ConstantInt>(CI->getOperand(1));
+        if (Opd1 && Opd1->isZero())
+            remove = true;
     }
-    return false;
+    if (CI->getOperand(1) == MPICallInst) {
+        ConstantInt *Opd0 = dyn_cast<ConstantInt>(CI->getOperand(0));
+        if (Opd0 && Opd0->isZero())
+            remove = true;
+    }
+    return remove ? TI->getSuccessor(0) : NULL;
 }
 
 /// We need to check every load/store instruction on
 /// the program path from a nonblocking call to a wait call.
-void MPINonblockingCall::doDataRaceDetection(map<CallBase *, MPIWaitCall *> &WCalls) {
-
-    identifyWaitCalls(WCalls);
+void MPINonblockingCall::collectRaceWindow(const AccessQuery &Query,
+                                           BufferOverlapIndex &Accesses) {
+    // Reused by the walks toward each wait call
+    ReachabilityIndex *RC = FCtx->Reachability;
+    BitVector visitedBBs(RC->getNumBlocks());
+    SmallVector<BasicBlock *, 32> toBeVisitedBBs;
+    uint64_t NumVisited = 0;
 
-    dumpInfo();
+    BasicBlock *BB = MPICallInst->getParent();
+    unsigned CallPos = FCtx->Requests->getPosition(MPICallInst);
+    unsigned CallWaitPos = getWaitPosition(BB, CallPos + 1);
+    BasicBlock *Skipped = getSkippedSuccessor();
 
-    for (set<MPIWaitCall *>::iterator it = MPIWaitCalls.begin(), ie = MPIWaitCalls.end();
-         it != ie; ++it) {
+    for (SetVector<MPIWaitCall *>::iterator it = MPIWaitCalls.begin(),
+         ie = MPIWaitCalls.end(); it != ie; ++it) {
         MPIWaitCall *WC = *it;
         CallBase *WCInst = WC->getMPICallInst();
 
+        visitedBBs.reset();
+        toBeVisitedBBs.clear();
+
         // Check instructions in the current block
-        Instruction *prevInsn = MPICallInst;
-        while (Instruction *curInsn = prevInsn->getNextNonDebugInstruction()) {
-            if (isWaitCallOfThisNonblockingCall(curInsn))
-                return;
-            checkInstruction(curInsn);
-            prevInsn = curInsn;
+        collectBlockAccesses(RC->getBlockId(BB), CallPos + 1, CallWaitPos,
+                             Query, Accesses);
+        if (CallWaitPos != ~0U) {
+            addCounter(VisitedBlocksCounter, NumVisited);
+            return;
         }
 
-        // Check instructions in successor blocks
-        BasicBlock *BB = MPICallInst->getParent();
-        set<BasicBlock *> visitedBBs;
-        list<BasicBlock *> toBeVisitedBBs;
+        // Check instructions in successor blocks, skipping a successor
+        // block only taken if the call fails
         Instruction *TI = BB->getTerminator();
         for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
             BasicBlock *Succ = TI->getSuccessor(i);
-            if (isReachable(Succ, WCInst->getParent()))
+            if (Succ != Skipped && RC->isReachable(Succ, WCInst->getParent()))
                 toBeVisitedBBs.push_back(Succ);
         }
-        // Check whether we need to remove a successor block
-        BranchInst *BI = dyn_cast<BranchInst>(TI);
-        if (BI && BI->isConditional()) {
-            Value *Cond = BI->getCondition();
-            CmpInst *CI = dyn_cast<CmpInst>(Cond);
-            if (CI && CI->getPredicate() == CmpInst::ICMP_NE) {
-                bool remove = false;
-                if (CI->getOperand(0) == MPICallInst) {
-                    ConstantInt *Opd1 = dyn_cast<ConstantInt>(CI->getOperand(1));
-                    if (Opd1 && Opd1->isZero())
-                        remove = true;
-                }
-                if (CI->getOperand(1) == MPICallInst) {
-                    ConstantInt *Opd0 = dyn_cast<ConstantInt>(CI->getOperand(0));
-                    if (Opd0 && Opd0->isZero())
-                        remove = true;
-                }
-                if (remove)
-                    toBeVisitedBBs.remove(TI->getSuccessor(0));
-            }
-        }
-        while (!toBeVisitedBBs.empty()) {
-            BasicBlock *curBB = toBeVisitedBBs.front();
-            toBeVisitedBBs.pop_front();
-            if (visitedBBs.count(curBB) != 0)
+        for (unsigned i = 0; i < toBeVisitedBBs.size(); ++i) {
+            BasicBlock *curBB = toBeVisitedBBs[i];
+            unsigned Id = RC->getBlockId(curBB);
+            if (visitedBBs.test(Id))
                 continue;
-            visitedBBs.insert(curBB);
-            bool stop = false;
-            for (BasicBlock::iterator it = curBB->begin(), ie = curBB->end();
-                 it != ie; ++it) {
-                Instruction *I = &*it;
-                if (isWaitCallOfThisNonblockingCall(I)) {
-                    stop = true;
-                    break;
-                }
-                checkInstruction(I);
+            visitedBBs.set(Id);
+            ++NumVisited;
+            if (!Budget.charge()) {
+                addCounter(VisitedBlocksCounter, NumVisited);
+                return;
             }
-            if (stop)
+            unsigned WaitPos = getWaitPosition(curBB, 0);
+            collectBlockAccesses(Id, 0, WaitPos, Query, Accesses);
+            if (WaitPos != ~0U)
                 continue;
             TI = curBB->getTerminator();
-            for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
-                BasicBlock *Succ = TI->getSuccessor(i);
-                if (isReachable(Succ, WCInst->getParent()))
+            for (unsigned s = 0; s < TI->getNumSuccessors(); ++s) {
+                BasicBlock *Succ = TI->getSuccessor(s);
+                if (RC->isReachable(Succ, WCInst->getParent()))
                     toBeVisitedBBs.push_back(Succ);
             }
         }
     }
+    addCounter(VisitedBlocksCounter, NumVisited);
+}
+
+void MPINonblockingCall::doDataRaceDetection(void) {
+    StringRef FuncName = MPICallInst->getFunction()->getName();
+    {
+        PhaseTimer PT(WaitCallsPhase, FuncName);
+        identifyWaitCalls();
+    }
+
+    dumpInfo();
+
+    BufferOverlapIndex Accesses(FCtx->RootPointers,
+                                MPICallInst->getModule()->getDataLayout());
+    BufferAccess Buffer;
+    getBufferLocation(Accesses, Buffer);
+    {
+        PhaseTimer PT(RaceWindowPhase, FuncName);
+        AccessQuery Query;
+        FCtx->BlockAccesses->getQuery(Buffer, Query);
+        collectRaceWindow(Query, Accesses);
+    }
+
+    PhaseTimer PT(OverlapPhase, FuncName);
+    Accesses.build();
+
+    SmallVector<unsigned, 8> Overlaps;
+    Accesses.findOverlaps(Buffer, Overlaps);
+    for (unsigned Idx : Overlaps)
+        reportRace(Buffer, Accesses.getAccess(Idx));
+    if (Budget.isExhausted())
+        reportIncomplete(Budget.getExhaustedLimit());
+}
+
+/// Start the budget of this call, drawing on that of its function
+void MPINonblockingCall::startBudget(void) {
+    Budget.start(FCtx->Ctx, &FCtx->Budget);
+}
+
+/// Report that the walks of this call were cut short, so that races in
+/// the blocks it did not visit may be missing
+void MPINonblockingCall::reportIncomplete(AnalysisBudget::Limit L) {
+    ++FCtx->NumIncompleteCalls;
+    OP << KYEL << "== Incomplete analysis of this call: reached the "
+       << AnalysisBudget::getLimitName(L) << "\n" << KNRM;
+}
+
+/// Locate the buffer of this call the way the accesses are located
+void MPINonblockingCall::getBufferLocation(BufferOverlapIndex &Index,
+                                           BufferAccess &Buffer) {
+    if (SummaryBuffer) {
+        SummaryBuffer->locate(MPICallInst, Index.getLayout(), Buffer);
+        return;
+    }
+    Index.getLocation(BufferStart, Buffer);
+    Buffer.Inst = MPICallInst;
+    Buffer.Size = BufferAccessSize;
+    Buffer.IsWrite = isWrite;
+}
+
+void MPINonblockingCall::reportRace(const BufferAccess &Buffer,
+                                    const BufferAccess &Access) {
+    Instruction *I = Access.Inst;
+    if (RaceCollector *RC = getRaceCollector())
+        RC->addRace(MPICallInst, Buffer, Access);
+    OP << KGRN << "== Found a data race:\n"
+       KMAG << "   ==" << *MPICallInst << "\n"
+       KYEL << "       == " << getSourceLine(MPICallInst) << "\n"
+       KMAG << "   ==" << *I << "\n"
+       KYEL << "       == " << getSourceLine(I) << "\n" << KNRM;
 }
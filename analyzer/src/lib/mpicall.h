@@ -3,25 +3,35 @@
 
 #include <set>
 
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+
+#include "blockaccess.h"
+#include "budget.h"
+#include "bufferoverlap.h"
 #include "common.h"
+#include "summary.h"
 
-class MPIRacePass;
+struct FunctionContext;
 
 class MPIWaitCall {
 private:
     CallBase *MPICallInst;
     StringRef APIName;
-    Value *WaitCount;
+    bool SingleRequest;
     Value *MPIRequest;
 
 public:
-    MPIWaitCall(CallBase *CI);
+    MPIWaitCall(CallBase *CI, const CallSummary *S = NULL);
 
     ~MPIWaitCall(void);
 
     CallBase *getMPICallInst(void);
 
-    bool isMatchedMPIRequest(Value *);
+    Value *getMPIRequest(void);
+
+    bool isSingleRequest(void);
 
     void dumpInfo(void);
 };
@@ -33,6 +43,10 @@ private:
     Value *BufferStart;
     uint64_t BufferAccessSize;
     bool isWrite;
+    // Buffer written by a call that also sends, e.g., MPI_Sendrecv, NULL
+    // if the call has a single buffer
+    Value *RecvBufferStart;
+    uint64_t RecvBufferAccessSize;
 
 public:
     MPIBlockingCall(CallBase *CI);
@@ -42,21 +56,44 @@ public:
     Value *getBufferStart(void);
 
     uint64_t getBufferAccessSize(void);
+
+    bool isBufferWrite(void);
+
+    Value *getRecvBufferStart(void) {
+        return RecvBufferStart;
+    }
+
+    uint64_t getRecvBufferAccessSize(void) {
+        return RecvBufferAccessSize;
+    }
 };
 
 class MPINonblockingCall {
 private:
-    MPIRacePass *MPass;
+    FunctionContext *FCtx;
     CallBase *MPICallInst;
     StringRef APIName;
     Value *BufferStart;
     uint64_t BufferAccessSize;
     bool isWrite;
     Value *MPIRequest;
-    set<MPIWaitCall *> MPIWaitCalls;
+    // Buffer relative to the operands of a call to a function that starts
+    // the request, NULL for an MPI call
+    const SummaryAccess *SummaryBuffer;
+    SetVector<MPIWaitCall *> MPIWaitCalls;
+    // Whether the wait calls complete the request on every path out of
+    // the function, and if not, the branches from which it escapes
+    bool CoversAllPaths;
+    SmallVector<BasicBlock *, 2> EscapePoints;
+    // Blocks and time left for the walks of this call
+    AnalysisBudget Budget;
+
+    bool findPostDominatingWait(SmallPtrSetImpl<MPIWaitCall *> &);
+
+    void computeEscapes(BitVector &Visited);
 
 public:
-    MPINonblockingCall(MPIRacePass *, CallBase *);
+    MPINonblockingCall(FunctionContext *, CallBase *);
 
     ~MPINonblockingCall(void);
 
@@ -74,17 +111,47 @@ public:
 
     void addWaitCall(MPIWaitCall *);
 
-    bool isWantedWaitCall(Instruction *, map<CallBase *, MPIWaitCall *> &);
+    bool isWantedWaitCall(MPIWaitCall *, SmallPtrSetImpl<MPIWaitCall *> &,
+                          SmallPtrSetImpl<MPIWaitCall *> &);
+
+    void startBudget(void);
+
+    AnalysisBudget &getBudget(void) {
+        return Budget;
+    }
+
+    void reportIncomplete(AnalysisBudget::Limit);
+
+    void identifyWaitCalls(void);
+
+    SetVector<MPIWaitCall *> &getWaitCalls(void);
+
+    bool coversAllPaths(void) {
+        return CoversAllPaths;
+    }
+
+    ArrayRef<BasicBlock *> getEscapePoints(void) {
+        return EscapePoints;
+    }
+
+    bool mayConflict(Instruction *);
+
+    void collectAccess(Instruction *, BufferOverlapIndex &);
+
+    unsigned getWaitPosition(BasicBlock *, unsigned From);
+
+    void collectBlockAccesses(unsigned Block, unsigned From, unsigned To,
+                              const AccessQuery &, BufferOverlapIndex &);
 
-    void identifyWaitCalls(map<CallBase *, MPIWaitCall *> &);
+    BasicBlock *getSkippedSuccessor(void);
 
-    bool checkBufferOverlap(Value *, uint64_t);
+    void collectRaceWindow(const AccessQuery &, BufferOverlapIndex &);
 
-    void checkInstruction(Instruction *);
+    void getBufferLocation(BufferOverlapIndex &, BufferAccess &);
 
-    bool isWaitCallOfThisNonblockingCall(Instruction *);
+    void reportRace(const BufferAccess &Buffer, const BufferAccess &Access);
 
-    void doDataRaceDetection(map<CallBase *, MPIWaitCall *> &);
+    void doDataRaceDetection(void);
 };
 
 #endif
@@ -9,48 +9,120 @@
 #include "llvm/Analysis/LoopInfo.h"
 
 #include "mpirace.h"
+#include "summaryindex.h"
 
-/// Iterate the instructions in current function to
-/// collect non-blocking and wait MPI calls
-void MPIRacePass::collectMPICalls() {
+/// Collect the non-blocking, blocking and wait MPI calls of the current
+/// function from its MPI call sites, in program order
+void FunctionContext::collectMPICalls(SmallVectorImpl<CallBase *> &Calls,
+                                      MPIAPIKindMap &Kinds) {
+    DenseMap<BasicBlock *, unsigned> BlockOrder;
+    unsigned NumBlocks = 0;
     for (Function::iterator bt = CurrentFunc->begin(), be = CurrentFunc->end();
-         bt != be; ++bt) {
-        BasicBlock *BB = &*bt;
-        for (BasicBlock::iterator it = BB->begin(), ie = BB->end();
-             it != ie; ++it) {
-            Instruction *I = &*it;
-            CallBase *CI = dyn_cast<CallBase>(I);
-            if (!CI)
-                continue;
-            Function *Callee = CI->getCalledFunction();
-            if (!Callee)
-                continue;
-            StringRef CalleeName = Callee->getName();
-            if (isMPINonblockingAPI(CalleeName))
-                NBCalls[CI] = new MPINonblockingCall(this, CI);
-            if (isMPIBlockingAPI(CalleeName))
-                BCalls[CI] = new MPIBlockingCall(CI);
-            if (isMPIWaitAPI(CalleeName))
-                WCalls[CI] = new MPIWaitCall(CI);
+         bt != be; ++bt)
+        BlockOrder[&*bt] = NumBlocks++;
+
+    SmallVector<CallBase *, 8> SortedCalls(Calls.begin(), Calls.end());
+    llvm::sort(SortedCalls, [&BlockOrder](CallBase *A, CallBase *B) {
+        if (A->getParent() != B->getParent())
+            return BlockOrder.lookup(A->getParent()) <
+                   BlockOrder.lookup(B->getParent());
+        return A != B && A->comesBefore(B);
+    });
+    SortedCalls.erase(unique(SortedCalls.begin(), SortedCalls.end()),
+                      SortedCalls.end());
+
+    for (CallBase *CI : SortedCalls) {
+        switch (Kinds.lookup(CI->getCalledFunction())) {
+        case MPINonblockingAPI:
+            NBCalls[CI] = new (NBCallAlloc.Allocate()) MPINonblockingCall(this, CI);
+            break;
+        case MPIBlockingAPI:
+            BCalls[CI] = new (BCallAlloc.Allocate()) MPIBlockingCall(CI);
+            break;
+        case MPIWaitAPI:
+            WCalls[CI] = new (WCallAlloc.Allocate())
+                MPIWaitCall(CI, getCalleeSummary(CI));
+            break;
+        default:
+            break;
         }
     }
 }
 
-MPINonblockingCall *MPIRacePass::getNonblockingCall(CallBase *CI) {
-    if (NBCalls.count(CI) > 0)
-        return NBCalls[CI];
-    else
-        return NULL;
+FunctionContext::~FunctionContext(void) {
+    // MPI call objects are destroyed with their allocators
+    delete CurrentLoopInfo;
+    delete Reachability;
+    delete RootPointers;
+    delete Requests;
+    delete PostDoms;
+    delete BlockAccesses;
 }
 
-MPIBlockingCall *MPIRacePass::getBlockingCall(CallBase *CI) {
-    if (BCalls.count(CI) > 0)
-        return BCalls[CI];
-    else
+MPINonblockingCall *FunctionContext::getNonblockingCall(CallBase *CI) {
+    return NBCalls.lookup(CI);
+}
+
+MPIBlockingCall *FunctionContext::getBlockingCall(CallBase *CI) {
+    return BCalls.lookup(CI);
+}
+
+/// Get the buffer accessed by a load, a store or an MPI call. Buffer 1 is
+/// the receive buffer of a blocking call that also sends.
+bool FunctionContext::getBufferAccess(Instruction *I, Value *&Ptr,
+                                      uint64_t &AccessSize, bool &IsWrite,
+                                      unsigned Buffer) {
+    if (Buffer) {
+        CallBase *CI = dyn_cast<CallBase>(I);
+        MPIBlockingCall *BC = CI ? getBlockingCall(CI) : NULL;
+        if (Buffer > 1 || !BC || !BC->getRecvBufferStart())
+            return false;
+        Ptr = BC->getRecvBufferStart();
+        AccessSize = BC->getRecvBufferAccessSize();
+        IsWrite = true;
+        return true;
+    }
+    if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        Ptr = LI->getPointerOperand();
+        AccessSize = getAccessSizeFromPointerType(LI->getPointerOperandType());
+        IsWrite = false;
+        return true;
+    }
+    if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+        Ptr = SI->getPointerOperand();
+        AccessSize = getAccessSizeFromPointerType(SI->getPointerOperandType());
+        IsWrite = true;
+        return true;
+    }
+    CallBase *CI = dyn_cast<CallBase>(I);
+    if (!CI)
+        return false;
+    if (MPINonblockingCall *NBC = getNonblockingCall(CI)) {
+        Ptr = NBC->getBufferStart();
+        AccessSize = NBC->getBufferAccessSize();
+        IsWrite = NBC->isBufferWrite();
+        return true;
+    }
+    if (MPIBlockingCall *BC = getBlockingCall(CI)) {
+        Ptr = BC->getBufferStart();
+        AccessSize = BC->getBufferAccessSize();
+        IsWrite = BC->isBufferWrite();
+        return true;
+    }
+    return false;
+}
+
+/// Get the summary of the function called by an instruction, NULL if it
+/// is not a call or the callee has no summary
+const CallSummary *FunctionContext::getCalleeSummary(Instruction *I) {
+    CallBase *CI = dyn_cast<CallBase>(I);
+    if (!CI || !Summaries)
         return NULL;
+    Function *Callee = CI->getCalledFunction();
+    return Callee ? Summaries->getSummary(Callee) : NULL;
 }
 
-bool MPIRacePass::isLoopInvariant(Value *V) {
+bool FunctionContext::isLoopInvariant(Value *V) {
     Instruction *I = dyn_cast<Instruction>(V);
     if (!I)
         return true;
@@ -63,8 +135,190 @@ bool MPIRacePass::isLoopInvariant(Value *V) {
 }
 
 /// Detect potential data races for this nonblocking call.
-void MPIRacePass::detectDataRaces(MPINonblockingCall *NBC) {
-    NBC->doDataRaceDetection(WCalls);
+void MPIRacePass::detectDataRaces(FunctionContext *FCtx,
+                                  MPINonblockingCall *NBC) {
+    NBC->startBudget();
+    NBC->doDataRaceDetection();
+}
+
+/// Classify the MPI functions of a module by name and find their call
+/// sites through the use lists, so that functions without MPI calls are
+/// never visited. Functions named as MPI APIs are classified even if the
+/// module defines them, e.g., PMPI wrappers or stubs.
+void MPIRacePass::collectMPICallSites(Module *M, MPIAPIKindMap &Kinds,
+                                      MPICallSiteMap &CallSites) {
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        Function *Callee = &*f;
+        MPIAPIKind Kind = classifyMPIAPI(Callee->getName());
+        if (Kind == NotMPIAPI)
+            continue;
+        Kinds[Callee] = Kind;
+        for (Use &U : Callee->uses()) {
+            CallBase *CI = dyn_cast<CallBase>(U.getUser());
+            if (!CI || !CI->isCallee(&U))
+                continue;
+            CallSites[CI->getFunction()].push_back(CI);
+        }
+    }
+}
+
+/// Treat the calls of defined functions that start or complete a request
+/// of their caller as nonblocking or wait calls. Functions already
+/// classified by their MPI API names keep their classification.
+void MPIRacePass::collectSummaryCallSites(Module *M, MPIAPIKindMap &Kinds,
+                                          MPICallSiteMap &CallSites) {
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        Function *Callee = &*f;
+        if (Kinds.count(Callee))
+            continue;
+        const CallSummary *S = Summaries->getSummary(Callee);
+        if (!S || S->getKind() == NotMPIAPI)
+            continue;
+        Kinds[Callee] = S->getKind();
+        for (Use &U : Callee->uses()) {
+            CallBase *CI = dyn_cast<CallBase>(U.getUser());
+            if (!CI || !CI->isCallee(&U))
+                continue;
+            CallSites[CI->getFunction()].push_back(CI);
+        }
+    }
+}
+
+/// Detect data races in a function, serving the report from the result
+/// cache if the function has a hash and is unchanged since it was cached.
+/// The races found are also recorded in Races unless it is NULL. Reports
+/// cut short by a budget are not cached. Cached races are always
+/// recorded, so that the entry can serve a later run with -output.
+void MPIRacePass::analyzeFunction(Function *F,
+                                  SmallVectorImpl<CallBase *> &Calls,
+                                  MPIAPIKindMap &Kinds, StringRef Hash,
+                                  RaceCollector *Races) {
+    if (Hash.empty()) {
+        RaceCollector *PrevRC = setRaceCollector(Races);
+        detectFunctionRaces(F, Calls, Kinds);
+        setRaceCollector(PrevRC);
+        return;
+    }
+
+    string Report;
+    vector<RaceRecord> Cached;
+    if (Cache->lookup(Hash, Report, Cached)) {
+        // The same function may be cached from a module at another path
+        for (RaceRecord &R : Cached)
+            R.Module = F->getParent()->getModuleIdentifier();
+        if (Races)
+            Races->restore(Cached);
+    } else {
+        RaceCollector Found;
+        raw_string_ostream OS(Report);
+        raw_ostream *PrevOS = setOutputStream(&OS);
+        RaceCollector *PrevRC = setRaceCollector(&Found);
+        bool Complete = detectFunctionRaces(F, Calls, Kinds);
+        setRaceCollector(PrevRC);
+        OS.flush();
+        setOutputStream(PrevOS);
+        if (Complete)
+            Cache->store(Hash, Report, Found.getRecords());
+        if (Races)
+            Races->append(Found);
+    }
+    OP << Report;
+}
+
+/// Detect data races in a function. In the dataflow mode, all the
+/// nonblocking calls are checked in one pass. Otherwise, in the parallel
+/// mode, the nonblocking calls of a large function are analyzed as
+/// separate tasks, and their reports are emitted in program order.
+/// Returns false if the analysis ran out of budget.
+bool MPIRacePass::detectFunctionRaces(Function *F,
+                                      SmallVectorImpl<CallBase *> &Calls,
+                                      MPIAPIKindMap &Kinds) {
+    FunctionTimer FT(F->getName(), F->getParent()->getModuleIdentifier());
+    FunctionContext FCtx(F, Ctx);
+    FCtx.Summaries = Summaries;
+    FCtx.Budget.start(Ctx, NULL);
+    {
+        PhaseTimer PT(CollectCallsPhase, F->getName());
+        FCtx.collectMPICalls(Calls, Kinds);
+    }
+
+    if (FCtx.NBCalls.size() == 0)
+        return true;
+    addCounter(FunctionsCounter);
+    addCounter(NonblockingCallsCounter, FCtx.NBCalls.size());
+
+    {
+        PhaseTimer PT(IndexPhase, F->getName());
+        FCtx.Requests = new MPIRequestIndex(&FCtx);
+        DominatorTree DT(*F);
+        FCtx.CurrentLoopInfo = new LoopInfo(DT);
+        FCtx.Reachability = new ReachabilityIndex(F);
+        FCtx.PostDoms = new PostDominanceIndex(F);
+        FCtx.RootPointers = new RootPointerResolver(F);
+        if (!Ctx->DataflowMode)
+            FCtx.BlockAccesses = new BlockAccessTable(&FCtx);
+    }
+    // Building the indexes visits every block, so that a function whose
+    // indexes take up the budget is cut short before any walk
+    FCtx.Budget.charge(F->size());
+
+    OP << "\n\n== Identified nonblocking MPI calls in <"
+       << F->getName() << ">:\n";
+
+    if (Ctx->DataflowMode) {
+        RequestFlowAnalysis RFA(&FCtx);
+        RFA.run();
+    } else if (!Pool || FCtx.NBCalls.size() < 2 ||
+               F->size() < Ctx->SplitFunctionSize) {
+        for (MapVector<CallBase *, MPINonblockingCall *>::iterator
+               it = FCtx.NBCalls.begin(), ie = FCtx.NBCalls.end();
+             it != ie; ++it) {
+            MPINonblockingCall *NBC = it->second;
+            detectDataRaces(&FCtx, NBC);
+        }
+    } else
+        detectCallRacesInParallel(&FCtx);
+
+    unsigned NumIncomplete = FCtx.NumIncompleteCalls;
+    if (!NumIncomplete)
+        return true;
+    addCounter(IncompleteFunctionsCounter);
+    OP << KYEL << "== Incomplete analysis of <" << F->getName() << ">: "
+       << NumIncomplete << " of " << FCtx.NBCalls.size()
+       << " nonblocking call(s) cut short\n" << KNRM;
+    return false;
+}
+
+/// Analyze the nonblocking calls of a large function as separate tasks,
+/// emitting their reports in program order
+void MPIRacePass::detectCallRacesInParallel(FunctionContext *FCtx) {
+    vector<string> Reports(FCtx->NBCalls.size());
+    RaceCollector *FuncRaces = getRaceCollector();
+    vector<RaceCollector> TaskRaces(FuncRaces ? FCtx->NBCalls.size() : 0);
+    TaskGroup TG;
+    unsigned i = 0;
+    for (MapVector<CallBase *, MPINonblockingCall *>::iterator
+           it = FCtx->NBCalls.begin(), ie = FCtx->NBCalls.end(); it != ie; ++it) {
+        MPINonblockingCall *NBC = it->second;
+        RaceCollector *Races = FuncRaces ? &TaskRaces[i] : NULL;
+        string *Report = &Reports[i++];
+        Pool->async(TG, [this, FCtx, NBC, Report, Races]() {
+            raw_string_ostream OS(*Report);
+            raw_ostream *PrevOS = setOutputStream(&OS);
+            RaceCollector *PrevRC = setRaceCollector(Races);
+            detectDataRaces(FCtx, NBC);
+            setRaceCollector(PrevRC);
+            OS.flush();
+            setOutputStream(PrevOS);
+        });
+    }
+    Pool->wait(TG);
+
+    for (unsigned i = 0; i < Reports.size(); ++i) {
+        OP << Reports[i];
+        if (FuncRaces)
+            FuncRaces->append(TaskRaces[i]);
+    }
 }
 
 bool MPIRacePass::doInitialization(Module *M) {
@@ -76,51 +330,145 @@ bool MPIRacePass::doFinalization(Module *M) {
 }
 
 bool MPIRacePass::doModulePass(Module *M) {
-    for (Module::iterator f = M->begin(), fe = M->end();
-         f != fe; ++f) {
-        CurrentFunc = &*f;
-
-        if (CurrentFunc->empty())
-            continue;
-
-        collectMPICalls();
+    MPIAPIKindMap Kinds;
+    MPICallSiteMap CallSites;
+    {
+        PhaseTimer PT(CollectCallsPhase, M->getModuleIdentifier());
+        collectMPICallSites(M, Kinds, CallSites);
+    }
+    if (Ctx->Interprocedural) {
+        Summaries = new SummaryEngine(M, Pool, Ctx->Imports);
+        Summaries->run();
+        if (!Ctx->SummaryFile.empty() &&
+            !writeModuleSummary(Ctx->SummaryFile, M, *Summaries))
+            OP << "== Error: cannot write summary file "
+               << Ctx->SummaryFile << "\n";
+        collectSummaryCallSites(M, Kinds, CallSites);
+    }
 
-        if (NBCalls.size() == 0)
+    // Functions with nonblocking MPI calls, in module order
+    vector<Function *> MPIFuncs;
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        MPICallSiteMap::iterator it = CallSites.find(&*f);
+        if (it == CallSites.end())
             continue;
+        for (CallBase *CI : it->second) {
+            if (Kinds.lookup(CI->getCalledFunction()) == MPINonblockingAPI) {
+                MPIFuncs.push_back(&*f);
+                break;
+            }
+        }
+    }
 
-        DominatorTree DT(*CurrentFunc);
-        CurrentLoopInfo = new LoopInfo(DT);
+    // Hash the functions up front, before any of them is analyzed
+    vector<string> Hashes(MPIFuncs.size());
+    if (Cache) {
+        for (unsigned i = 0; i < MPIFuncs.size(); ++i)
+            Hashes[i] = Cache->hashFunction(
+                MPIFuncs[i],
+                Summaries ? Summaries->getCalleeSummaries(MPIFuncs[i]) : "");
+    }
 
-        OP << "\n\n== Identified nonblocking MPI calls in <"
-           << CurrentFunc->getName() << ">:\n";
-        for (map<CallBase *, MPINonblockingCall *>::iterator
-               it = NBCalls.begin(), ie = NBCalls.end(); it != ie; ++it) {
-            MPINonblockingCall *NBC = it->second;
-            detectDataRaces(NBC);
+    // With a deadline, the cheapest functions go first, so that as many
+    // functions as possible are reported before it
+    vector<unsigned> Order(MPIFuncs.size());
+    for (unsigned i = 0; i < Order.size(); ++i)
+        Order[i] = i;
+    if (Ctx->HasDeadline) {
+        vector<uint64_t> Costs(MPIFuncs.size());
+        for (unsigned i = 0; i < MPIFuncs.size(); ++i) {
+            unsigned NumCalls = 0;
+            for (CallBase *CI : CallSites[MPIFuncs[i]]) {
+                if (Kinds.lookup(CI->getCalledFunction()) == MPINonblockingAPI)
+                    ++NumCalls;
+            }
+            Costs[i] = estimateFunctionCost(MPIFuncs[i], NumCalls);
         }
+        stable_sort(Order.begin(), Order.end(), [&Costs](unsigned A,
+                                                         unsigned B) {
+            return Costs[A] < Costs[B];
+        });
+    }
+    auto PastDeadline = [this]() {
+        return Ctx->isPastDeadline();
+    };
 
-        // Do clearnup
-        for (map<CallBase *, MPINonblockingCall *>::iterator
-               it = NBCalls.begin(), ie = NBCalls.end(); it != ie; ++it) {
-            MPINonblockingCall *NBC = it->second;
-            delete NBC;
-        }
-        NBCalls.clear();
-        for (map<CallBase *, MPIBlockingCall *>::iterator
-               it = BCalls.begin(), ie = BCalls.end(); it != ie; ++it) {
-            MPIBlockingCall *BC = it->second;
-            delete BC;
-        }
-        BCalls.clear();
-        for (map<CallBase *, MPIWaitCall *>::iterator
-               it = WCalls.begin(), ie = WCalls.end(); it != ie; ++it) {
-            MPIWaitCall *WC = it->second;
-            delete WC;
+    ReportWriter *Writer = Ctx->Reports;
+    vector<Function *> Skipped;
+    if (!Pool) {
+        for (unsigned i : Order) {
+            Function *F = MPIFuncs[i];
+            if (PastDeadline()) {
+                Skipped.push_back(F);
+                continue;
+            }
+            RaceCollector Races;
+            analyzeFunction(F, CallSites[F], Kinds, Hashes[i],
+                            Writer ? &Races : NULL);
+            if (Writer)
+                Writer->write(Races);
         }
-        WCalls.clear();
+        reportSkipped(Skipped);
+        delete Summaries;
+        Summaries = NULL;
+        return false;
+    }
+
+    // Analyze the functions in parallel, buffering the report and the
+    // races of each function so that the output is identical to the
+    // serial run. The submitting thread runs its own tasks last submitted
+    // first, so the cheapest functions are submitted last.
+    vector<string> Reports(MPIFuncs.size());
+    vector<RaceCollector> FuncRaces(Writer ? MPIFuncs.size() : 0);
+    vector<char> Started(MPIFuncs.size(), true);
+    TaskGroup TG;
+    for (unsigned k = 0; k < Order.size(); ++k) {
+        unsigned i = Ctx->HasDeadline ? Order[Order.size() - 1 - k] : k;
+        Function *F = MPIFuncs[i];
+        SmallVectorImpl<CallBase *> *Calls = &CallSites[F];
+        StringRef Hash = Hashes[i];
+        RaceCollector *Races = Writer ? &FuncRaces[i] : NULL;
+        string *Report = &Reports[i];
+        char *Start = &Started[i];
+        Pool->async(TG, [this, F, Calls, &Kinds, Hash, Report, Races, Start,
+                         &PastDeadline]() {
+            if (PastDeadline()) {
+                *Start = false;
+                return;
+            }
+            raw_string_ostream OS(*Report);
+            raw_ostream *PrevOS = setOutputStream(&OS);
+            analyzeFunction(F, *Calls, Kinds, Hash, Races);
+            OS.flush();
+            setOutputStream(PrevOS);
+        });
+    }
+    Pool->wait(TG);
 
-        delete CurrentLoopInfo;
+    for (unsigned i : Order) {
+        if (!Started[i]) {
+            Skipped.push_back(MPIFuncs[i]);
+            continue;
+        }
+        OP << Reports[i];
+        if (Writer)
+            Writer->write(FuncRaces[i]);
     }
+    reportSkipped(Skipped);
 
+    delete Summaries;
+    Summaries = NULL;
     return false;
 }
+
+/// List the functions not analyzed because the deadline had passed
+void MPIRacePass::reportSkipped(ArrayRef<Function *> Skipped) {
+    if (Skipped.empty())
+        return;
+    addCounter(SkippedFunctionsCounter, Skipped.size());
+    OP << KYEL << "\n== Deadline reached, skipped " << Skipped.size()
+       << " function(s):";
+    for (Function *F : Skipped)
+        OP << " <" << F->getName() << ">";
+    OP << "\n" << KNRM;
+}
@@ -1,14 +1,41 @@
 #ifndef _MPIRACE_H_
 #define _MPIRACE_H_
 
+#include <atomic>
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Support/Allocator.h"
+
+#include "blockaccess.h"
 #include "global.h"
 #include "mpicall.h"
+#include "postdom.h"
+#include "reachability.h"
+#include "requestflow.h"
+#include "requestindex.h"
+#include "report.h"
+#include "resultcache.h"
+#include "rootpointer.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "summary.h"
 
-class MPIRacePass : public IterativeModulePass {
-private:
-    map<CallBase *, MPINonblockingCall *> NBCalls;
-    map<CallBase *, MPIBlockingCall *> BCalls;
-    map<CallBase *, MPIWaitCall *> WCalls;
+typedef DenseMap<Function *, MPIAPIKind> MPIAPIKindMap;
+// MPI call sites of a module, grouped by the calling function
+typedef DenseMap<Function *, SmallVector<CallBase *, 8>> MPICallSiteMap;
+
+/// Analysis state of a single function. Each function is analyzed with
+/// its own context, so that functions can be analyzed concurrently.
+struct FunctionContext {
+    // MPI calls in the function, nonblocking calls in program order
+    MapVector<CallBase *, MPINonblockingCall *> NBCalls;
+    DenseMap<CallBase *, MPIBlockingCall *> BCalls;
+    DenseMap<CallBase *, MPIWaitCall *> WCalls;
+
+    // Storage of the MPI call objects, freed with the context
+    SpecificBumpPtrAllocator<MPINonblockingCall> NBCallAlloc;
+    SpecificBumpPtrAllocator<MPIBlockingCall> BCallAlloc;
+    SpecificBumpPtrAllocator<MPIWaitCall> WCallAlloc;
 
     // Function we are currently working on
     Function *CurrentFunc;
@@ -16,24 +43,117 @@ private:
     // LoopInfo of the current function
     LoopInfo *CurrentLoopInfo;
 
+    // Block reachability of the current function
+    ReachabilityIndex *Reachability;
+
+    // Root pointers of the pointers in the current function
+    RootPointerResolver *RootPointers;
+
+    // Wait calls of the current function by request
+    MPIRequestIndex *Requests;
+
+    // Post-dominators of the current function
+    PostDominanceIndex *PostDoms;
+
+    // Accesses of the blocks of the current function, NULL in the
+    // dataflow mode
+    BlockAccessTable *BlockAccesses;
+
+    // Summaries of the callees, NULL if calls are opaque
+    SummaryEngine *Summaries;
+
+    // Options of the run, for the limits of the budgets
+    const GlobalContext *Ctx;
+
+    // Blocks and time left for the function, shared by its calls, and
+    // the number of calls whose analysis was cut short
+    AnalysisBudget Budget;
+    atomic<unsigned> NumIncompleteCalls;
+
+    FunctionContext(Function *F, const GlobalContext *Ctx_)
+        : CurrentFunc(F), CurrentLoopInfo(NULL), Reachability(NULL),
+          RootPointers(NULL), Requests(NULL), PostDoms(NULL),
+          BlockAccesses(NULL), Summaries(NULL), Ctx(Ctx_),
+          NumIncompleteCalls(0) {}
+
+    ~FunctionContext(void);
+
+    void collectMPICalls(SmallVectorImpl<CallBase *> &, MPIAPIKindMap &);
+
+    MPINonblockingCall *getNonblockingCall(CallBase *);
+
+    MPIBlockingCall *getBlockingCall(CallBase *);
+
+    bool getBufferAccess(Instruction *, Value *&, uint64_t &, bool &,
+                         unsigned Buffer = 0);
+
+    const CallSummary *getCalleeSummary(Instruction *);
+
+    bool isLoopInvariant(Value *);
+};
+
+class MPIRacePass : public IterativeModulePass {
+private:
+    // Scheduler for the parallel mode, NULL when analyzing serially
+    WorkStealingPool *Pool;
+
+    // Reports of unchanged functions, NULL when not caching results
+    ResultCache *Cache;
+
+    // Summaries of the module being analyzed, NULL unless interprocedural
+    SummaryEngine *Summaries;
+
 public:
     MPIRacePass(GlobalContext *Ctx_) :
         IterativeModulePass(Ctx_, "MPIRacePass") {
+        Pool = NULL;
+        if (Ctx->NumThreads > 1)
+            Pool = new WorkStealingPool(Ctx->NumThreads);
+        Cache = NULL;
+        Summaries = NULL;
+        if (!Ctx->ResultCacheDir.empty())
+            Cache = new ResultCache(Ctx->ResultCacheDir, Ctx);
     }
 
     ~MPIRacePass(void) {
+        delete Pool;
+        if (Cache) {
+            Cache->printStats();
+            delete Cache;
+        }
+        if (Ctx->VerboseLevel > 0) {
+            OP << "== Visited " << getCounter(VisitedBlocksCounter)
+               << " blocks from " << getCounter(NonblockingCallsCounter)
+               << " nonblocking calls\n";
+            printStatistics(OP);
+        }
+        if (!Ctx->TraceFile.empty() && !writeChromeTrace(Ctx->TraceFile))
+            OP << "== Error: cannot write trace file " << Ctx->TraceFile
+               << "\n";
+        if (uint64_t N = getCounter(IncompleteFunctionsCounter))
+            OP << "== Incomplete analysis of " << N << " function(s)\n";
+        if (uint64_t N = getCounter(SkippedFunctionsCounter))
+            OP << "== Skipped " << N << " function(s) at the deadline\n";
+        if (uint64_t N = getCounter(SkippedFilesCounter))
+            OP << "== Skipped " << N << " file(s) at the deadline\n";
         OP << "== Done ==\n";
     }
 
-    void collectMPICalls();
+    void detectDataRaces(FunctionContext *, MPINonblockingCall *);
 
-    MPINonblockingCall *getNonblockingCall(CallBase *);
+    void collectMPICallSites(Module *, MPIAPIKindMap &, MPICallSiteMap &);
 
-    MPIBlockingCall *getBlockingCall(CallBase *);
+    void collectSummaryCallSites(Module *, MPIAPIKindMap &, MPICallSiteMap &);
 
-    bool isLoopInvariant(Value *);
+    void analyzeFunction(Function *, SmallVectorImpl<CallBase *> &,
+                         MPIAPIKindMap &, StringRef, RaceCollector *);
+
+    bool detectFunctionRaces(Function *, SmallVectorImpl<CallBase *> &,
+                             MPIAPIKindMap &);
+
+    void detectCallRacesInParallel(FunctionContext *);
 
-    void detectDataRaces(MPINonblockingCall *);
+    void reportSkipped(ArrayRef<Function *>);
 
     virtual bool doInitialization(Module *);
 
@@ -0,0 +1,36 @@
+#include "llvm/IR/CFG.h"
+
+#include "postdom.h"
+
+PostDominanceIndex::PostDominanceIndex(Function *F) : PDT(*F) {
+    computeFrontiers(F);
+}
+
+BasicBlock *PostDominanceIndex::getIPostDom(BasicBlock *BB) {
+    DomTreeNode *Node = PDT.getNode(BB);
+    if (!Node || !Node->getIDom())
+        return NULL;
+    return Node->getIDom()->getBlock();
+}
+
+/// Frontiers are computed as dominance frontiers on the reverse CFG: from
+/// each successor of a branch, walk up the tree until the immediate
+/// post-dominator of the branch, which every path from the branch reaches
+void PostDominanceIndex::computeFrontiers(Function *F) {
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt) {
+        BasicBlock *BB = &*bt;
+        Instruction *TI = BB->getTerminator();
+        if (!TI || TI->getNumSuccessors() < 2 || !PDT.getNode(BB))
+            continue;
+        BasicBlock *IPDom = getIPostDom(BB);
+        for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
+            BasicBlock *Runner = TI->getSuccessor(i);
+            while (Runner && Runner != IPDom) {
+                SmallVector<BasicBlock *, 2> &Frontier = Frontiers[Runner];
+                if (Frontier.empty() || Frontier.back() != BB)
+                    Frontier.push_back(BB);
+                Runner = getIPostDom(Runner);
+            }
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _POSTDOM_H_
+#define _POSTDOM_H_
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/Instructions.h"
+
+#include "common.h"
+
+/// Post-dominator tree of a function along with the post-dominance
+/// frontier of each block, computed once and shared by the nonblocking
+/// calls of the function. The frontier of a block holds the branches
+/// from which control may avoid the block on its way out.
+class PostDominanceIndex {
+private:
+    PostDominatorTree PDT;
+    DenseMap<BasicBlock *, SmallVector<BasicBlock *, 2>> Frontiers;
+
+    void computeFrontiers(Function *);
+
+public:
+    PostDominanceIndex(Function *F);
+
+    /// Check whether every path from B to the exit passes through A
+    bool postDominates(BasicBlock *A, BasicBlock *B) {
+        return PDT.dominates(A, B);
+    }
+
+    /// Immediate post-dominator of a block, NULL if it is the exit or the
+    /// block has none, e.g., in an infinite loop
+    BasicBlock *getIPostDom(BasicBlock *);
+
+    ArrayRef<BasicBlock *> getFrontier(BasicBlock *BB) {
+        DenseMap<BasicBlock *, SmallVector<BasicBlock *, 2>>::iterator it =
+            Frontiers.find(BB);
+        if (it == Frontiers.end())
+            return None;
+        return it->second;
+    }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "llvm/IR/CFG.h"
+
+#include "reachability.h"
+
+ReachabilityIndex::ReachabilityIndex(Function *F) {
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt) {
+        BasicBlock *BB = &*bt;
+        BlockIds[BB] = Blocks.size();
+        Blocks.push_back(BB);
+    }
+    computeSCCs();
+    computeClosure();
+}
+
+/// Iterative Tarjan's algorithm over all blocks, including the ones
+/// that are unreachable from the entry block
+void ReachabilityIndex::computeSCCs(void) {
+    const unsigned Unvisited = ~0U;
+    unsigned NumBlocks = Blocks.size();
+    vector<unsigned> Index(NumBlocks, Unvisited);
+    vector<unsigned> LowLink(NumBlocks, 0);
+    BitVector OnStack(NumBlocks);
+    vector<unsigned> Stack;
+    // DFS frames of (block, next successor to visit)
+    vector<pair<unsigned, unsigned>> Frames;
+    unsigned NextIndex = 0, NumSCCs = 0;
+
+    BlockSCCs.assign(NumBlocks, 0);
+    for (unsigned Root = 0; Root < NumBlocks; ++Root) {
+        if (Index[Root] != Unvisited)
+            continue;
+        Frames.push_back(make_pair(Root, 0));
+        while (!Frames.empty()) {
+            unsigned B = Frames.back().first;
+            unsigned SuccIdx = Frames.back().second;
+            if (SuccIdx == 0 && Index[B] == Unvisited) {
+                Index[B] = LowLink[B] = NextIndex++;
+                Stack.push_back(B);
+                OnStack.set(B);
+            }
+
+            Instruction *TI = Blocks[B]->getTerminator();
+            unsigned NumSuccs = TI ? TI->getNumSuccessors() : 0;
+            if (SuccIdx < NumSuccs) {
+                ++Frames.back().second;
+                unsigned S = BlockIds[TI->getSuccessor(SuccIdx)];
+                if (Index[S] == Unvisited)
+                    Frames.push_back(make_pair(S, 0));
+                else if (OnStack.test(S))
+                    LowLink[B] = min(LowLink[B], Index[S]);
+                continue;
+            }
+
+            // All successors are done
+            Frames.pop_back();
+            if (!Frames.empty()) {
+                unsigned Parent = Frames.back().first;
+                LowLink[Parent] = min(LowLink[Parent], LowLink[B]);
+            }
+            if (LowLink[B] != Index[B])
+                continue;
+            unsigned Member;
+            do {
+                Member = Stack.back();
+                Stack.pop_back();
+                OnStack.reset(Member);
+                BlockSCCs[Member] = NumSCCs;
+            } while (Member != B);
+            ++NumSCCs;
+        }
+    }
+
+    ReachableSCCs.resize(NumSCCs);
+}
+
+/// Propagate reachability from the sink SCCs upwards
+void ReachabilityIndex::computeClosure(void) {
+    unsigned NumSCCs = ReachableSCCs.size();
+    vector<vector<unsigned>> SCCBlocks(NumSCCs);
+    for (unsigned B = 0; B < Blocks.size(); ++B)
+        SCCBlocks[BlockSCCs[B]].push_back(B);
+
+    for (unsigned C = 0; C < NumSCCs; ++C) {
+        BitVector &Reach = ReachableSCCs[C];
+        Reach.resize(C + 1);
+        if (SCCBlocks[C].size() > 1)
+            Reach.set(C);
+        for (unsigned B : SCCBlocks[C]) {
+            Instruction *TI = Blocks[B]->getTerminator();
+            if (!TI)
+                continue;
+            for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
+                unsigned SC = BlockSCCs[BlockIds[TI->getSuccessor(i)]];
+                if (SC == C) {
+                    // Self loop
+                    Reach.set(C);
+                    continue;
+                }
+                if (Reach.test(SC))
+                    continue;
+                Reach.set(SC);
+                Reach |= ReachableSCCs[SC];
+            }
+        }
+    }
+}
+
+bool ReachabilityIndex::isReachable(BasicBlock *Src, BasicBlock *Dst) {
+    if (Src == Dst)
+        return true;
+
+    unsigned SrcSCC = BlockSCCs[getBlockId(Src)];
+    unsigned DstSCC = BlockSCCs[getBlockId(Dst)];
+    if (DstSCC > SrcSCC)
+        return false;
+    return ReachableSCCs[SrcSCC].test(DstSCC);
+}
@@ -0,0 +1,51 @@
+#ifndef _REACHABILITY_H_
+#define _REACHABILITY_H_
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+#include "common.h"
+
+/// Block-level reachability of a function, computed once and queried in
+/// constant time. Blocks are numbered densely, the CFG is condensed into
+/// its strongly connected components, and every SCC keeps a bitset of
+/// the SCCs it can reach.
+class ReachabilityIndex {
+private:
+    DenseMap<BasicBlock *, unsigned> BlockIds;
+    vector<BasicBlock *> Blocks;
+
+    // SCC of each block. SCCs are numbered in reverse topological order,
+    // so an edge never goes from an SCC to one with a larger number.
+    vector<unsigned> BlockSCCs;
+
+    // SCCs reachable from each SCC through at least one edge. An SCC
+    // reaches itself only if it contains a cycle.
+    vector<BitVector> ReachableSCCs;
+
+    void computeSCCs(void);
+
+    void computeClosure(void);
+
+public:
+    ReachabilityIndex(Function *F);
+
+    unsigned getNumBlocks(void) {
+        return Blocks.size();
+    }
+
+    unsigned getBlockId(BasicBlock *BB) {
+        return BlockIds.lookup(BB);
+    }
+
+    BasicBlock *getBlock(unsigned Id) {
+        return Blocks[Id];
+    }
+
+    /// Check whether the Dst block is reachable from the Src block
+    bool isReachable(BasicBlock *Src, BasicBlock *Dst);
+};
+
+#endif
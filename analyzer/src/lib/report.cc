@@ -0,0 +1,423 @@
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+
+#include "report.h"
+
+// Collector of the current thread, NULL if races are not recorded
+static thread_local RaceCollector *ThreadCollector = NULL;
+
+RaceCollector *getRaceCollector(void) {
+    return ThreadCollector;
+}
+
+RaceCollector *setRaceCollector(RaceCollector *RC) {
+    RaceCollector *PrevRC = ThreadCollector;
+    ThreadCollector = RC;
+    return PrevRC;
+}
+
+static void getSourceLocation(Instruction *I, SourceLocation &Loc) {
+    Loc.Line = 0;
+    Loc.Column = 0;
+    DILocation *DL = I->getDebugLoc().get();
+    if (!DL || DL->getLine() < 1)
+        return;
+    Loc.File = DL->getFilename().str();
+    if (!DL->getDirectory().empty() && !sys::path::is_absolute(Loc.File))
+        Loc.File = (DL->getDirectory() + "/" + Loc.File).str();
+    Loc.Line = DL->getLine();
+    Loc.Column = DL->getColumn();
+}
+
+static void getBufferRange(const BufferAccess &A, BufferRange &R) {
+    raw_string_ostream OS(R.Base);
+    A.Base->printAsOperand(OS, false);
+    OS.flush();
+    R.Offset = A.Offset;
+    R.Size = A.Size;
+}
+
+/// Name of the function called, looking through casts of the callee, or
+/// an empty string for an indirect call
+static string getCalleeName(CallBase *CI) {
+    Function *Callee =
+        dyn_cast<Function>(CI->getCalledOperand()->stripPointerCasts());
+    return Callee ? Callee->getName().str() : "";
+}
+
+static string printInstruction(Instruction *I) {
+    string S;
+    raw_string_ostream OS(S);
+    OS << *I;
+    OS.flush();
+    return StringRef(S).trim().str();
+}
+
+void RaceCollector::addRace(CallBase *Call, const BufferAccess &Buffer,
+                            const BufferAccess &Access) {
+    Instruction *I = Access.Inst;
+    DenseMap<pair<Instruction *, Instruction *>, unsigned>::iterator it =
+        Index.find(make_pair((Instruction *)Call, I));
+    if (it != Index.end()) {
+        ++Records[it->second].Occurrences;
+        return;
+    }
+
+    RaceRecord R;
+    Function *F = Call->getFunction();
+    R.Module = F->getParent()->getModuleIdentifier();
+    R.Function = F->getName().str();
+
+    R.Call = getCalleeName(Call);
+    R.CallInst = printInstruction(Call);
+    getSourceLocation(Call, R.CallLoc);
+    getBufferRange(Buffer, R.CallBuffer);
+    R.CallWrites = Buffer.IsWrite;
+
+    if (isa<LoadInst>(I))
+        R.Access = "load";
+    else if (isa<StoreInst>(I))
+        R.Access = "store";
+    else
+        R.Access = getCalleeName(cast<CallBase>(I));
+    R.AccessInst = printInstruction(I);
+    getSourceLocation(I, R.AccessLoc);
+    getBufferRange(Access, R.AccessBuffer);
+    R.AccessWrites = Access.IsWrite;
+
+    R.Occurrences = 1;
+    addRecord(Call, I, R);
+}
+
+void RaceCollector::addRecord(Instruction *Call, Instruction *Access,
+                              RaceRecord &R) {
+    pair<Instruction *, Instruction *> Key(Call, Access);
+    // Restored records have no instructions
+    if (Call)
+        Index[Key] = Records.size();
+    Keys.push_back(Key);
+    Records.push_back(move(R));
+}
+
+void RaceCollector::append(RaceCollector &Other) {
+    for (unsigned i = 0; i < Other.Records.size(); ++i) {
+        RaceRecord &R = Other.Records[i];
+        DenseMap<pair<Instruction *, Instruction *>, unsigned>::iterator it =
+            Index.find(Other.Keys[i]);
+        if (it != Index.end())
+            Records[it->second].Occurrences += R.Occurrences;
+        else
+            addRecord(Other.Keys[i].first, Other.Keys[i].second, R);
+    }
+    Other.Records.clear();
+    Other.Keys.clear();
+    Other.Index.clear();
+}
+
+void RaceCollector::restore(vector<RaceRecord> &Restored) {
+    for (RaceRecord &R : Restored)
+        addRecord(NULL, NULL, R);
+    Restored.clear();
+}
+
+void writeEncodedString(support::endian::Writer &W, StringRef S) {
+    W.write<uint32_t>(S.size());
+    W.OS << S;
+}
+
+static void writeLocation(support::endian::Writer &W,
+                          const SourceLocation &L) {
+    writeEncodedString(W, L.File);
+    W.write<uint32_t>(L.Line);
+    W.write<uint32_t>(L.Column);
+}
+
+static void writeRange(support::endian::Writer &W, const BufferRange &R) {
+    writeEncodedString(W, R.Base);
+    W.write<int64_t>(R.Offset);
+    W.write<uint64_t>(R.Size);
+}
+
+void writeRaceRecords(support::endian::Writer &W,
+                      const vector<RaceRecord> &Records) {
+    W.write<uint32_t>(Records.size());
+    for (const RaceRecord &R : Records) {
+        writeEncodedString(W, R.Module);
+        writeEncodedString(W, R.Function);
+        writeEncodedString(W, R.Call);
+        writeEncodedString(W, R.CallInst);
+        writeLocation(W, R.CallLoc);
+        writeRange(W, R.CallBuffer);
+        W.write<uint8_t>(R.CallWrites);
+        writeEncodedString(W, R.Access);
+        writeEncodedString(W, R.AccessInst);
+        writeLocation(W, R.AccessLoc);
+        writeRange(W, R.AccessBuffer);
+        W.write<uint8_t>(R.AccessWrites);
+        W.write<uint32_t>(R.Occurrences);
+    }
+}
+
+void RecordReader::readLocation(SourceLocation &L) {
+    L.File = readString();
+    L.Line = read<uint32_t>();
+    L.Column = read<uint32_t>();
+}
+
+void RecordReader::readRange(BufferRange &R) {
+    R.Base = readString();
+    R.Offset = read<int64_t>();
+    R.Size = read<uint64_t>();
+}
+
+void RecordReader::readRaceRecords(vector<RaceRecord> &Records) {
+    // Each record takes more than a byte
+    uint32_t NumRecords = read<uint32_t>();
+    if (NumRecords > (size_t)(End - Cur))
+        Failed = true;
+    Records.resize(Failed ? 0 : NumRecords);
+    for (RaceRecord &R : Records) {
+        R.Module = readString();
+        R.Function = readString();
+        R.Call = readString();
+        R.CallInst = readString();
+        readLocation(R.CallLoc);
+        readRange(R.CallBuffer);
+        R.CallWrites = read<uint8_t>();
+        R.Access = readString();
+        R.AccessInst = readString();
+        readLocation(R.AccessLoc);
+        readRange(R.AccessBuffer);
+        R.AccessWrites = read<uint8_t>();
+        R.Occurrences = read<uint32_t>();
+    }
+    if (Failed)
+        Records.clear();
+}
+
+// Source lines and printed IR may contain anything
+static json::Value toJSON(StringRef S) {
+    if (json::isUTF8(S))
+        return S;
+    return json::fixUTF8(S);
+}
+
+static void writeBufferRange(json::OStream &J, const BufferRange &R) {
+    J.object([&] {
+        J.attribute("base", toJSON(R.Base));
+        J.attribute("offset", R.Offset);
+        J.attribute("size", (int64_t)R.Size);
+    });
+}
+
+static void writeSourceLocation(json::OStream &J, const SourceLocation &L) {
+    J.object([&] {
+        J.attribute("file", toJSON(L.File));
+        J.attribute("line", (int64_t)L.Line);
+        J.attribute("column", (int64_t)L.Column);
+    });
+}
+
+static void writeSARIFLocation(json::OStream &J, const RaceRecord &R,
+                               const SourceLocation &L) {
+    J.object([&] {
+        if (L.Line) {
+            J.attributeObject("physicalLocation", [&] {
+                J.attributeObject("artifactLocation", [&] {
+                    J.attribute("uri", toJSON(L.File));
+                });
+                J.attributeObject("region", [&] {
+                    J.attribute("startLine", (int64_t)L.Line);
+                    if (L.Column)
+                        J.attribute("startColumn", (int64_t)L.Column);
+                });
+            });
+        }
+        J.attributeArray("logicalLocations", [&] {
+            J.object([&] {
+                J.attribute("fullyQualifiedName", toJSON(R.Function));
+                J.attribute("kind", "function");
+            });
+        });
+    });
+}
+
+static string describeLocation(const SourceLocation &L) {
+    if (!L.Line)
+        return "unknown location";
+    return L.File + ":" + to_string(L.Line);
+}
+
+void ReportWriter::writeRecord(const RaceRecord &R) {
+    json::OStream J(*OS);
+    if (Format == JSONReport) {
+        J.object([&] {
+            J.attribute("module", toJSON(R.Module));
+            J.attribute("function", toJSON(R.Function));
+            J.attributeObject("call", [&] {
+                J.attribute("api", toJSON(R.Call));
+                J.attribute("instruction", toJSON(R.CallInst));
+                J.attributeBegin("location");
+                writeSourceLocation(J, R.CallLoc);
+                J.attributeEnd();
+                J.attributeBegin("buffer");
+                writeBufferRange(J, R.CallBuffer);
+                J.attributeEnd();
+                J.attribute("write", R.CallWrites);
+            });
+            J.attributeObject("access", [&] {
+                J.attribute("kind", toJSON(R.Access));
+                J.attribute("instruction", toJSON(R.AccessInst));
+                J.attributeBegin("location");
+                writeSourceLocation(J, R.AccessLoc);
+                J.attributeEnd();
+                J.attributeBegin("buffer");
+                writeBufferRange(J, R.AccessBuffer);
+                J.attributeEnd();
+                J.attribute("write", R.AccessWrites);
+            });
+            J.attribute("occurrences", (int64_t)R.Occurrences);
+        });
+        return;
+    }
+
+    J.object([&] {
+        J.attribute("ruleId", "mpi-data-race");
+        J.attribute("level", "warning");
+        J.attributeObject("message", [&] {
+            J.attribute("text",
+                        toJSON("Buffer of " + R.Call + " at " +
+                               describeLocation(R.CallLoc) +
+                               " is accessed by a " + R.Access + " at " +
+                               describeLocation(R.AccessLoc) +
+                               " before the request completes"));
+        });
+        J.attributeArray("locations", [&] {
+            writeSARIFLocation(J, R, R.CallLoc);
+        });
+        J.attributeArray("relatedLocations", [&] {
+            J.object([&] {
+                J.attribute("id", 1);
+                J.attributeObject("message", [&] {
+                    J.attribute("text", "conflicting access");
+                });
+                if (R.AccessLoc.Line) {
+                    J.attributeObject("physicalLocation", [&] {
+                        J.attributeObject("artifactLocation", [&] {
+                            J.attribute("uri", toJSON(R.AccessLoc.File));
+                        });
+                        J.attributeObject("region", [&] {
+                            J.attribute("startLine",
+                                        (int64_t)R.AccessLoc.Line);
+                            if (R.AccessLoc.Column)
+                                J.attribute("startColumn",
+                                            (int64_t)R.AccessLoc.Column);
+                        });
+                    });
+                }
+            });
+        });
+        J.attributeObject("properties", [&] {
+            J.attribute("module", toJSON(R.Module));
+            J.attribute("callInstruction", toJSON(R.CallInst));
+            J.attributeBegin("callBuffer");
+            writeBufferRange(J, R.CallBuffer);
+            J.attributeEnd();
+            J.attribute("accessInstruction", toJSON(R.AccessInst));
+            J.attributeBegin("accessBuffer");
+            writeBufferRange(J, R.AccessBuffer);
+            J.attributeEnd();
+            J.attribute("occurrences", (int64_t)R.Occurrences);
+        });
+    });
+}
+
+void ReportWriter::writerLoop(void) {
+    unique_lock<mutex> Guard(Lock);
+    while (true) {
+        HasWork.wait(Guard, [this]() {
+            return Stopping || !Batches.empty();
+        });
+        if (Batches.empty())
+            return;
+        vector<RaceRecord> Batch = move(Batches.front());
+        Batches.pop_front();
+        Guard.unlock();
+
+        for (const RaceRecord &R : Batch) {
+            *OS << (NumRecords++ ? ",\n" : "\n");
+            writeRecord(R);
+        }
+
+        Guard.lock();
+    }
+}
+
+ReportWriter::ReportWriter(StringRef File, ReportFormat Format_,
+                           error_code &EC)
+    : OS(new raw_fd_ostream(File, EC, sys::fs::OF_Text)), Format(Format_),
+      NumRecords(0), Stopping(false) {
+    if (EC)
+        return;
+    OS->SetBufferSize(1 << 20);
+    if (Format == JSONReport) {
+        *OS << "{\"tool\": \"mpirace\", \"races\": [";
+    } else {
+        *OS << "{\"$schema\": "
+              "\"https://json.schemastore.org/sarif-2.1.0.json\", "
+              "\"version\": \"2.1.0\", \"runs\": [{\"tool\": {\"driver\": "
+              "{\"name\": \"mpirace\", \"rules\": [{\"id\": "
+              "\"mpi-data-race\", \"shortDescription\": {\"text\": "
+              "\"Buffer of a nonblocking MPI call accessed before the "
+              "request completes\"}}]}}, \"results\": [";
+    }
+    Writer = thread(&ReportWriter::writerLoop, this);
+}
+
+ReportWriter::~ReportWriter(void) {
+    if (!Writer.joinable())
+        return;
+    {
+        lock_guard<mutex> Guard(Lock);
+        Stopping = true;
+    }
+    HasWork.notify_one();
+    Writer.join();
+
+    *OS << (NumRecords ? "\n" : "");
+    if (Format == JSONReport)
+        *OS << "]}\n";
+    else
+        *OS << "]}]}\n";
+}
+
+ReportWriter::ReportWriter(void)
+    : Format(JSONReport), NumRecords(0), Stopping(false) {
+}
+
+void ReportWriter::write(RaceCollector &RC) {
+    write(RC.getRecords());
+}
+
+void ReportWriter::write(vector<RaceRecord> &Records) {
+    if (Records.empty())
+        return;
+    {
+        lock_guard<mutex> Guard(Lock);
+        if (OS)
+            Batches.push_back(move(Records));
+        else
+            move(Records.begin(), Records.end(), back_inserter(Kept));
+    }
+    Records.clear();
+    HasWork.notify_one();
+}
+
+void ReportWriter::takeRecords(vector<RaceRecord> &Records) {
+    lock_guard<mutex> Guard(Lock);
+    Records = move(Kept);
+    Kept.clear();
+}
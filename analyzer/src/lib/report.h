@@ -0,0 +1,200 @@
+#ifndef _REPORT_H_
+#define _REPORT_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "bufferoverlap.h"
+
+using namespace llvm;
+using namespace std;
+
+enum ReportFormat {
+    JSONReport,
+    SARIFReport
+};
+
+/// Source position of an instruction, Line is 0 without debug info
+struct SourceLocation {
+    string File;
+    unsigned Line;
+    unsigned Column;
+};
+
+/// Bytes [Offset, Offset + Size) from the printed base pointer, Size is
+/// 0 if unknown
+struct BufferRange {
+    string Base;
+    int64_t Offset;
+    uint64_t Size;
+};
+
+/// A data race between the buffer of a nonblocking call and an access
+/// before the request completes. Everything is rendered when the race is
+/// found, so that records outlive the module.
+struct RaceRecord {
+    string Module;
+    string Function;
+
+    string Call;
+    string CallInst;
+    SourceLocation CallLoc;
+    BufferRange CallBuffer;
+    bool CallWrites;
+
+    // Load, store or the called function
+    string Access;
+    string AccessInst;
+    SourceLocation AccessLoc;
+    BufferRange AccessBuffer;
+    bool AccessWrites;
+
+    // Number of times the race was reported
+    unsigned Occurrences;
+};
+
+/// Races found while analyzing a function (or a nonblocking call), in
+/// the order they are reported. A race reported again for the same pair
+/// of instructions, e.g., on the walk toward another wait call, only
+/// counts as another occurrence of the first record.
+class RaceCollector {
+private:
+    vector<RaceRecord> Records;
+    // Instructions of each record, only used while the module is alive
+    vector<pair<Instruction *, Instruction *>> Keys;
+    DenseMap<pair<Instruction *, Instruction *>, unsigned> Index;
+
+    void addRecord(Instruction *, Instruction *, RaceRecord &);
+
+public:
+    void addRace(CallBase *Call, const BufferAccess &Buffer,
+                 const BufferAccess &Access);
+
+    /// Move the records of another collector into this one
+    void append(RaceCollector &);
+
+    /// Add records rendered earlier, e.g., those of a cached report. They
+    /// are never merged with other records.
+    void restore(vector<RaceRecord> &);
+
+    vector<RaceRecord> &getRecords(void) {
+        return Records;
+    }
+};
+
+/// Write a string prefixed by its length
+void writeEncodedString(support::endian::Writer &, StringRef);
+
+/// Encode race records, e.g., to hand them over to another process or to
+/// cache them along with the report they belong to
+void writeRaceRecords(support::endian::Writer &, const vector<RaceRecord> &);
+
+/// Decoder of encoded strings and race records. Reads past the end set
+/// Failed.
+class RecordReader {
+private:
+    const char *Cur;
+    const char *End;
+
+    void readLocation(SourceLocation &);
+
+    void readRange(BufferRange &);
+
+public:
+    bool Failed;
+
+    RecordReader(StringRef Data)
+        : Cur(Data.begin()), End(Data.end()), Failed(false) {}
+
+    bool atEnd(void) {
+        return Cur == End;
+    }
+
+    template <typename T> T read(void) {
+        if (Failed || (size_t)(End - Cur) < sizeof(T)) {
+            Failed = true;
+            return T();
+        }
+        T V = support::endian::read<T, support::little, support::unaligned>(
+            Cur);
+        Cur += sizeof(T);
+        return V;
+    }
+
+    StringRef readBytes(size_t Len) {
+        if (Failed || (size_t)(End - Cur) < Len) {
+            Failed = true;
+            return "";
+        }
+        StringRef S(Cur, Len);
+        Cur += Len;
+        return S;
+    }
+
+    string readString(void) {
+        return readBytes(read<uint32_t>()).str();
+    }
+
+    void readRaceRecords(vector<RaceRecord> &);
+};
+
+/// Collector of the current thread, NULL if races are not recorded
+RaceCollector *getRaceCollector(void);
+
+/// Set the collector of the current thread and return the previous one
+RaceCollector *setRaceCollector(RaceCollector *);
+
+/// Write race records to a file as JSON or SARIF. Records are formatted
+/// and written by a background thread through a buffered stream, so the
+/// analysis only hands over a batch of rendered records per function.
+class ReportWriter {
+private:
+    // Output file, NULL if the records are kept in memory
+    unique_ptr<raw_fd_ostream> OS;
+    ReportFormat Format;
+    unsigned NumRecords;
+
+    mutex Lock;
+    condition_variable HasWork;
+    deque<vector<RaceRecord>> Batches;
+    bool Stopping;
+    thread Writer;
+    // Records kept in memory
+    vector<RaceRecord> Kept;
+
+    void writeRecord(const RaceRecord &);
+
+    void writerLoop(void);
+
+public:
+    /// Open the output file, EC is set if it cannot be opened
+    ReportWriter(StringRef File, ReportFormat, error_code &EC);
+
+    /// Keep the records in memory instead, e.g., in a worker process that
+    /// hands them over to its parent
+    ReportWriter(void);
+
+    /// Finish the document and close the file
+    ~ReportWriter(void);
+
+    /// Queue the records of a collector for writing
+    void write(RaceCollector &);
+
+    /// Queue rendered records for writing, e.g., those of a worker
+    void write(vector<RaceRecord> &);
+
+    /// Take the records kept in memory so far
+    void takeRecords(vector<RaceRecord> &);
+};
+
+#endif
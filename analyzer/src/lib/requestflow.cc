@@ -0,0 +1,360 @@
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/LoopInfo.h"
+
+#include "mpirace.h"
+#include "requestflow.h"
+
+RequestFlowAnalysis::RequestFlowAnalysis(FunctionContext *FC)
+    : FCtx(FC), Buffers(FC->RootPointers,
+                        FC->CurrentFunc->getParent()->getDataLayout()) {
+    for (MapVector<CallBase *, MPINonblockingCall *>::iterator
+           it = FCtx->NBCalls.begin(), ie = FCtx->NBCalls.end(); it != ie; ++it)
+        Calls.push_back(it->second);
+
+    unsigned NumCalls = Calls.size();
+    Blocks.resize(FCtx->Reachability->getNumBlocks());
+    for (BlockState &BS : Blocks) {
+        BS.In.resize(NumCalls);
+        BS.Waits.resize(NumCalls);
+        BS.Reaching.resize(NumCalls);
+    }
+    WaitBlocks.resize(NumCalls);
+    TailEnds.assign(NumCalls, ~0U);
+    Truncated = AnalysisBudget::NoLimit;
+}
+
+/// Find the first wait call of each call in each block, and the blocks
+/// from which a wait call of each call is reachable
+void RequestFlowAnalysis::computeWaitPositions(void) {
+    MPIRequestIndex *RI = FCtx->Requests;
+    ReachabilityIndex *RC = FCtx->Reachability;
+    for (unsigned n = 0; n < Calls.size(); ++n) {
+        CallBase *CI = Calls[n]->getMPICallInst();
+        unsigned CallPos = RI->getPosition(CI);
+        SetVector<MPIWaitCall *> &WaitCalls = Calls[n]->getWaitCalls();
+        for (SetVector<MPIWaitCall *>::iterator it = WaitCalls.begin(),
+             ie = WaitCalls.end(); it != ie; ++it) {
+            CallBase *WCInst = (*it)->getMPICallInst();
+            BasicBlock *WB = WCInst->getParent();
+            unsigned Pos = RI->getPosition(WCInst);
+            WaitBlocks[n].push_back(WB);
+
+            BlockState &BS = Blocks[RC->getBlockId(WB)];
+            BS.Waits.set(n);
+            pair<DenseMap<unsigned, unsigned>::iterator, bool> Ins =
+                BS.FirstWaits.insert(make_pair(n, Pos));
+            if (!Ins.second && Pos < Ins.first->second)
+                Ins.first->second = Pos;
+            if (WB == CI->getParent() && Pos > CallPos)
+                TailEnds[n] = min(TailEnds[n], Pos);
+        }
+    }
+
+    for (unsigned b = 0; b < Blocks.size(); ++b) {
+        BasicBlock *BB = RC->getBlock(b);
+        for (unsigned n = 0; n < Calls.size(); ++n) {
+            for (BasicBlock *WB : WaitBlocks[n]) {
+                if (RC->isReachable(BB, WB)) {
+                    Blocks[b].Reaching.set(n);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/// Propagate the outstanding calls from each call to the blocks on its
+/// paths to its wait calls. A request is no longer outstanding after a
+/// block with one of its wait calls, and blocks that cannot reach one of
+/// its wait calls are never entered.
+void RequestFlowAnalysis::propagate(void) {
+    ReachabilityIndex *RC = FCtx->Reachability;
+    vector<unsigned> Worklist;
+    BitVector InWorklist(Blocks.size());
+    uint64_t NumVisited = 0;
+
+    for (unsigned n = 0; n < Calls.size(); ++n) {
+        // The request is completed in the block of the call
+        if (WaitBlocks[n].empty() || TailEnds[n] != ~0U)
+            continue;
+        BasicBlock *Skipped = Calls[n]->getSkippedSuccessor();
+        Instruction *TI = Calls[n]->getMPICallInst()->getParent()->getTerminator();
+        for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
+            BasicBlock *Succ = TI->getSuccessor(i);
+            if (Succ == Skipped)
+                continue;
+            unsigned Id = RC->getBlockId(Succ);
+            if (!Blocks[Id].Reaching.test(n) || Blocks[Id].In.test(n))
+                continue;
+            Blocks[Id].In.set(n);
+            if (!InWorklist.test(Id)) {
+                InWorklist.set(Id);
+                Worklist.push_back(Id);
+            }
+        }
+    }
+
+    while (!Worklist.empty()) {
+        unsigned Id = Worklist.back();
+        Worklist.pop_back();
+        InWorklist.reset(Id);
+        ++NumVisited;
+        // The states so far are kept, so the calls miss some blocks
+        if (!FCtx->Budget.charge()) {
+            Truncated = FCtx->Budget.getExhaustedLimit();
+            break;
+        }
+
+        BitVector Out = Blocks[Id].In;
+        Out.reset(Blocks[Id].Waits);
+        if (Out.none())
+            continue;
+        Instruction *TI = RC->getBlock(Id)->getTerminator();
+        for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
+            unsigned SuccId = RC->getBlockId(TI->getSuccessor(i));
+            BitVector New = Out;
+            New &= Blocks[SuccId].Reaching;
+            if (!New.test(Blocks[SuccId].In))
+                continue;
+            Blocks[SuccId].In |= New;
+            if (!InWorklist.test(SuccId)) {
+                InWorklist.set(SuccId);
+                Worklist.push_back(SuccId);
+            }
+        }
+    }
+    addCounter(VisitedBlocksCounter, NumVisited);
+}
+
+const string &RequestFlowAnalysis::getBaseDiagnostics(Value *Base) {
+    DenseMap<Value *, string>::iterator it = BaseDiagnostics.find(Base);
+    if (it != BaseDiagnostics.end())
+        return it->second;
+
+    string Diagnostics;
+    raw_string_ostream OS(Diagnostics);
+    raw_ostream *PrevOS = setOutputStream(&OS);
+    set<Value *> Roots;
+    FCtx->RootPointers->collectRootPointers(Base, Roots);
+    OS.flush();
+    setOutputStream(PrevOS);
+    return BaseDiagnostics[Base] = Diagnostics;
+}
+
+/// Locate the accesses of the blocks with outstanding requests and check
+/// each of them against the buffers of all the calls
+void RequestFlowAnalysis::collectAccesses(void) {
+    ReachabilityIndex *RC = FCtx->Reachability;
+    raw_null_ostream NullOS;
+    raw_ostream *PrevOS = setOutputStream(&NullOS);
+    for (unsigned n = 0; n < Calls.size(); ++n) {
+        BufferAccess Buffer;
+        Calls[n]->getBufferLocation(Buffers, Buffer);
+        Buffers.addAccess(Buffer);
+    }
+    Buffers.build();
+    setOutputStream(PrevOS);
+
+    BitVector Scanned(Blocks.size());
+    for (unsigned n = 0; n < Calls.size(); ++n) {
+        if (!WaitBlocks[n].empty())
+            Scanned.set(RC->getBlockId(Calls[n]->getMPICallInst()->getParent()));
+    }
+    for (unsigned b = 0; b < Blocks.size(); ++b) {
+        if (Blocks[b].In.any())
+            Scanned.set(b);
+    }
+
+    // Keep the accesses that print something or race
+    auto Check = [&](BlockState &BS, AccessInfo &A) {
+        SmallVector<unsigned, 8> Overlaps;
+        raw_ostream *PrevOS = setOutputStream(&NullOS);
+        Buffers.findOverlaps(A.Loc, Overlaps);
+        setOutputStream(PrevOS);
+        if (A.SizeError.empty() && Overlaps.empty() &&
+            getBaseDiagnostics(A.Loc.Base).empty())
+            return;
+        A.Races.append(Overlaps.begin(), Overlaps.end());
+        BS.Accesses.push_back(move(A));
+    };
+
+    const DataLayout &DL = Buffers.getLayout();
+    for (unsigned b : Scanned.set_bits()) {
+        BasicBlock *BB = RC->getBlock(b);
+        unsigned Pos = 0;
+        for (BasicBlock::iterator it = BB->begin(), ie = BB->end();
+             it != ie; ++it, ++Pos) {
+            Instruction *I = &*it;
+            // A call of a summarized function accesses what its summary
+            // does
+            if (const CallSummary *S = FCtx->getCalleeSummary(I)) {
+                SmallVector<BufferAccess, 4> CallAccesses;
+                S->getCallAccesses(cast<CallBase>(I), DL, CallAccesses);
+                for (BufferAccess &Loc : CallAccesses) {
+                    AccessInfo A;
+                    A.Inst = I;
+                    A.Pos = Pos;
+                    A.Loc = Loc;
+                    Check(Blocks[b], A);
+                }
+                continue;
+            }
+
+            // Blocking calls that also receive access a second buffer
+            for (unsigned k = 0;; ++k) {
+                AccessInfo A;
+                Value *Ptr;
+                uint64_t AccessSize;
+                bool IsWrite;
+                {
+                    raw_string_ostream OS(A.SizeError);
+                    PrevOS = setOutputStream(&OS);
+                    bool IsAccess = FCtx->getBufferAccess(I, Ptr, AccessSize,
+                                                          IsWrite, k);
+                    OS.flush();
+                    setOutputStream(PrevOS);
+                    if (!IsAccess)
+                        break;
+                }
+
+                A.Inst = I;
+                A.Pos = Pos;
+                Buffers.getLocation(Ptr, A.Loc);
+                A.Loc.Inst = I;
+                A.Loc.Size = AccessSize;
+                A.Loc.IsWrite = IsWrite;
+                Check(Blocks[b], A);
+            }
+        }
+    }
+}
+
+/// Order the blocks on the paths from a call to its wait calls as the
+/// breadth-first walk of the per-call mode visits them
+void RequestFlowAnalysis::getVisitOrder(unsigned n,
+                                        vector<BasicBlock *> &Order) {
+    ReachabilityIndex *RC = FCtx->Reachability;
+    BitVector visitedBBs(RC->getNumBlocks());
+    SmallVector<BasicBlock *, 32> toBeVisitedBBs;
+    BasicBlock *Skipped = Calls[n]->getSkippedSuccessor();
+    Instruction *TI = Calls[n]->getMPICallInst()->getParent()->getTerminator();
+    for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
+        BasicBlock *Succ = TI->getSuccessor(i);
+        if (Succ != Skipped && Blocks[RC->getBlockId(Succ)].In.test(n))
+            toBeVisitedBBs.push_back(Succ);
+    }
+    for (unsigned i = 0; i < toBeVisitedBBs.size(); ++i) {
+        BasicBlock *curBB = toBeVisitedBBs[i];
+        unsigned Id = RC->getBlockId(curBB);
+        if (visitedBBs.test(Id))
+            continue;
+        visitedBBs.set(Id);
+        Order.push_back(curBB);
+        if (Blocks[Id].Waits.test(n))
+            continue;
+        TI = curBB->getTerminator();
+        for (unsigned s = 0; s < TI->getNumSuccessors(); ++s) {
+            BasicBlock *Succ = TI->getSuccessor(s);
+            if (Blocks[RC->getBlockId(Succ)].In.test(n))
+                toBeVisitedBBs.push_back(Succ);
+        }
+    }
+}
+
+/// Print the diagnostics and the races of a call in the order of the
+/// per-call mode: the walk toward each wait call in turn, then the root
+/// pointers of the accessed bases and of the buffer, then the races
+void RequestFlowAnalysis::emitReports(unsigned n) {
+    ReachabilityIndex *RC = FCtx->Reachability;
+    MPINonblockingCall *NBC = Calls[n];
+    string Collected, Bases;
+    SmallPtrSet<Value *, 16> SeenBases;
+    vector<const BufferAccess *> Races;
+
+    auto Visit = [&](BasicBlock *BB, unsigned Begin, unsigned End) {
+        BlockState &BS = Blocks[RC->getBlockId(BB)];
+        for (AccessInfo &A : BS.Accesses) {
+            if (A.Pos < Begin)
+                continue;
+            if (A.Pos >= End)
+                break;
+            if (!NBC->mayConflict(A.Inst))
+                continue;
+            Collected += A.SizeError;
+            if (SeenBases.insert(A.Loc.Base).second)
+                Bases += getBaseDiagnostics(A.Loc.Base);
+            if (is_contained(A.Races, n))
+                Races.push_back(&A.Loc);
+        }
+    };
+
+    if (!WaitBlocks[n].empty()) {
+        CallBase *CI = NBC->getMPICallInst();
+        BasicBlock *CallBB = CI->getParent();
+        unsigned CallPos = FCtx->Requests->getPosition(CI);
+        vector<BasicBlock *> Order;
+        if (TailEnds[n] == ~0U)
+            getVisitOrder(n, Order);
+        for (BasicBlock *WB : WaitBlocks[n]) {
+            Visit(CallBB, CallPos + 1, TailEnds[n]);
+            if (TailEnds[n] != ~0U)
+                break;
+            for (BasicBlock *BB : Order) {
+                if (!RC->isReachable(BB, WB))
+                    continue;
+                BlockState &BS = Blocks[RC->getBlockId(BB)];
+                DenseMap<unsigned, unsigned>::iterator it =
+                    BS.FirstWaits.find(n);
+                Visit(BB, 0, it == BS.FirstWaits.end() ? ~0U : it->second);
+            }
+        }
+    }
+
+    BufferAccess Loc;
+    NBC->getBufferLocation(Buffers, Loc);
+    OP << Collected << Bases << getBaseDiagnostics(Loc.Base);
+    for (const BufferAccess *A : Races)
+        NBC->reportRace(Loc, *A);
+
+    AnalysisBudget &Budget = NBC->getBudget();
+    if (Budget.isExhausted())
+        NBC->reportIncomplete(Budget.getExhaustedLimit());
+    else if (Truncated && !WaitBlocks[n].empty() && TailEnds[n] == ~0U)
+        NBC->reportIncomplete(Truncated);
+}
+
+void RequestFlowAnalysis::run(void) {
+    // Identify the wait calls of all the calls up front, keeping what each
+    // call prints for its report
+    StringRef FuncName = FCtx->CurrentFunc->getName();
+    vector<string> Headers(Calls.size());
+    {
+        PhaseTimer PT(WaitCallsPhase, FuncName);
+        for (unsigned n = 0; n < Calls.size(); ++n) {
+            raw_string_ostream OS(Headers[n]);
+            raw_ostream *PrevOS = setOutputStream(&OS);
+            Calls[n]->startBudget();
+            Calls[n]->identifyWaitCalls();
+            Calls[n]->dumpInfo();
+            OS.flush();
+            setOutputStream(PrevOS);
+        }
+    }
+
+    {
+        PhaseTimer PT(RaceWindowPhase, FuncName);
+        computeWaitPositions();
+        propagate();
+    }
+    {
+        PhaseTimer PT(OverlapPhase, FuncName);
+        collectAccesses();
+    }
+
+    PhaseTimer PT(RaceWindowPhase, FuncName);
+    for (unsigned n = 0; n < Calls.size(); ++n) {
+        OP << Headers[n];
+        emitReports(n);
+    }
+}
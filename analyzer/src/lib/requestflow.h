@@ -0,0 +1,90 @@
+#ifndef _REQUESTFLOW_H_
+#define _REQUESTFLOW_H_
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Instructions.h"
+
+#include "budget.h"
+#include "bufferoverlap.h"
+#include "common.h"
+
+class MPINonblockingCall;
+struct FunctionContext;
+
+/// Forward dataflow over the outstanding requests of a function. Bit i of
+/// the state at the entry of a block is set if the request of the i-th
+/// nonblocking call may still be outstanding there, i.e., the block is on
+/// a path from the call to one of its wait calls. The states of all the
+/// nonblocking calls are computed in one pass, and every memory access in
+/// those blocks is located once and checked against the buffers of all
+/// the calls at once. The reports of each call are then emitted in the
+/// order the per-call walk (MPINonblockingCall::doDataRaceDetection)
+/// visits the accesses, so that both modes print identical reports.
+class RequestFlowAnalysis {
+private:
+    struct AccessInfo {
+        Instruction *Inst;
+        // Position in the block
+        unsigned Pos;
+        // Accessed bytes
+        BufferAccess Loc;
+        // Printed when computing the access size, i.e., every time the
+        // access is visited
+        string SizeError;
+        // Nonblocking calls whose buffers the access overlaps
+        SmallVector<unsigned, 2> Races;
+    };
+
+    struct BlockState {
+        // Calls outstanding at the entry of the block
+        BitVector In;
+        // Calls with a wait call in the block
+        BitVector Waits;
+        // Calls with a wait call reachable from the block
+        BitVector Reaching;
+        // Position of the first wait call of each call in the block
+        DenseMap<unsigned, unsigned> FirstWaits;
+        // Accesses that print something or race, in program order
+        vector<AccessInfo> Accesses;
+    };
+
+    FunctionContext *FCtx;
+    vector<MPINonblockingCall *> Calls;
+    vector<BlockState> Blocks;
+    // Buffers of the calls, numbered as the calls
+    BufferOverlapIndex Buffers;
+
+    // Blocks of the wait calls of each call, one per wait call
+    vector<SmallVector<BasicBlock *, 2>> WaitBlocks;
+    // Position of the first wait call of each call after the call in its
+    // block, or ~0U if there is none
+    vector<unsigned> TailEnds;
+
+    // Diagnostics printed when resolving the root pointers of a base
+    DenseMap<Value *, string> BaseDiagnostics;
+
+    // Limit of the function budget that cut the propagation short, if any
+    AnalysisBudget::Limit Truncated;
+
+    void computeWaitPositions(void);
+
+    void propagate(void);
+
+    void collectAccesses(void);
+
+    const string &getBaseDiagnostics(Value *);
+
+    void getVisitOrder(unsigned, vector<BasicBlock *> &);
+
+    void emitReports(unsigned);
+
+public:
+    RequestFlowAnalysis(FunctionContext *);
+
+    /// Detect data races of all the nonblocking calls of the function
+    void run(void);
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/LoopInfo.h"
+
+#include "mpirace.h"
+#include "requestindex.h"
+
+/// Build the index in one pass over the blocks containing MPI calls
+MPIRequestIndex::MPIRequestIndex(FunctionContext *FCtx) {
+    SmallPtrSet<BasicBlock *, 16> MPIBlocks;
+    for (DenseMap<CallBase *, MPIWaitCall *>::iterator it = FCtx->WCalls.begin(),
+         ie = FCtx->WCalls.end(); it != ie; ++it)
+        MPIBlocks.insert(it->first->getParent());
+    for (MapVector<CallBase *, MPINonblockingCall *>::iterator
+           it = FCtx->NBCalls.begin(), ie = FCtx->NBCalls.end(); it != ie; ++it)
+        MPIBlocks.insert(it->first->getParent());
+
+    Function *F = FCtx->CurrentFunc;
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt) {
+        BasicBlock *BB = &*bt;
+        if (!MPIBlocks.count(BB))
+            continue;
+        unsigned Pos = 0;
+        for (BasicBlock::iterator it = BB->begin(), ie = BB->end();
+             it != ie; ++it, ++Pos) {
+            CallBase *CI = dyn_cast<CallBase>(&*it);
+            if (!CI)
+                continue;
+            Positions[CI] = Pos;
+            MPIWaitCall *WC = FCtx->WCalls.lookup(CI);
+            if (!WC)
+                continue;
+            BlockWaitCalls[BB].push_back(WC);
+
+            SmallVector<RequestSlot, 4> Slots;
+            getRequestSlots(WC->getMPIRequest(), true,
+                            WC->isSingleRequest(), Slots);
+            for (RequestSlot &Slot : Slots)
+                SlotWaitCalls[Slot].push_back(WC);
+        }
+    }
+}
+
+static bool isCPPSTLCall(CallBase *CB) {
+    Function *Callee = CB->getCalledFunction();
+    return Callee && isCPPSTLAPI(Callee->getName());
+}
+
+/// Normalize a request of a nonblocking call (IsWait is false) or of a
+/// wait call into the slots it can be matched through
+void MPIRequestIndex::getRequestSlots(Value *MR, bool IsWait,
+                                      bool SingleRequest,
+                                      SmallVectorImpl<RequestSlot> &Slots) {
+    if (!IsWait || SingleRequest)
+        Slots.push_back(RequestSlot(ExactSlot, MR));
+
+    if (GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(MR)) {
+        Value *Base = GEPI->getPointerOperand();
+        Slots.push_back(RequestSlot(GEPBaseSlot, Base));
+        if (LoadInst *LI = dyn_cast<LoadInst>(Base))
+            Slots.push_back(RequestSlot(IsWait ? LoadedRequestSlot
+                                               : LoadedBaseSlot,
+                                        LI->getPointerOperand()));
+    }
+
+    if (LoadInst *LI = dyn_cast<LoadInst>(MR))
+        Slots.push_back(RequestSlot(IsWait ? LoadedBaseSlot
+                                           : LoadedRequestSlot,
+                                    LI->getPointerOperand()));
+
+    CallBase *CB = dyn_cast<CallBase>(MR);
+    if (CB && isCPPSTLCall(CB))
+        Slots.push_back(RequestSlot(STLVectorSlot, CB->getArgOperand(0)));
+}
+
+void MPIRequestIndex::getMatchingWaitCalls(
+        Value *MR, SmallPtrSetImpl<MPIWaitCall *> &WaitCalls) {
+    SmallVector<RequestSlot, 4> Slots;
+    getRequestSlots(MR, false, false, Slots);
+    for (RequestSlot &Slot : Slots) {
+        DenseMap<RequestSlot, SmallVector<MPIWaitCall *, 2>>::iterator
+            it = SlotWaitCalls.find(Slot);
+        if (it != SlotWaitCalls.end())
+            WaitCalls.insert(it->second.begin(), it->second.end());
+    }
+}
+
+ArrayRef<MPIWaitCall *> MPIRequestIndex::getWaitCallsInBlock(BasicBlock *BB) {
+    DenseMap<BasicBlock *, SmallVector<MPIWaitCall *, 2>>::iterator
+        it = BlockWaitCalls.find(BB);
+    if (it == BlockWaitCalls.end())
+        return ArrayRef<MPIWaitCall *>();
+    return it->second;
+}
@@ -0,0 +1,64 @@
+#ifndef _REQUESTINDEX_H_
+#define _REQUESTINDEX_H_
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Instructions.h"
+
+#include "common.h"
+
+class MPIWaitCall;
+struct FunctionContext;
+
+/// Index of the wait calls of a function by the request slot they
+/// complete. A request is normalized into slots, one per way it can be
+/// matched: the request itself, the base of a request array accessed
+/// through a GEP, a request loaded from (or a request array based on a
+/// load from) an address, and the vector of a C++ operator[] call. A wait
+/// call completes a nonblocking request if they share a slot.
+class MPIRequestIndex {
+public:
+    enum SlotKind {
+        // Same request of a wait call completing a single request
+        ExactSlot,
+        // GEPs into the same request array
+        GEPBaseSlot,
+        // Nonblocking request in an array loaded from the address, and a
+        // wait request loaded from the address
+        LoadedBaseSlot,
+        // Nonblocking request loaded from the address, and a wait request
+        // in an array loaded from the address
+        LoadedRequestSlot,
+        // Elements of the same std::vector
+        STLVectorSlot,
+    };
+
+    typedef pair<unsigned, Value *> RequestSlot;
+
+private:
+    DenseMap<RequestSlot, SmallVector<MPIWaitCall *, 2>> SlotWaitCalls;
+    // Wait calls of each block, in program order
+    DenseMap<BasicBlock *, SmallVector<MPIWaitCall *, 2>> BlockWaitCalls;
+    // Position of the MPI calls in their blocks
+    DenseMap<CallBase *, unsigned> Positions;
+
+    static void getRequestSlots(Value *, bool IsWait, bool SingleRequest,
+                                SmallVectorImpl<RequestSlot> &);
+
+public:
+    MPIRequestIndex(FunctionContext *);
+
+    /// Collect the wait calls that complete the request of a nonblocking
+    /// call
+    void getMatchingWaitCalls(Value *, SmallPtrSetImpl<MPIWaitCall *> &);
+
+    ArrayRef<MPIWaitCall *> getWaitCallsInBlock(BasicBlock *);
+
+    unsigned getPosition(CallBase *CI) {
+        return Positions.lookup(CI);
+    }
+};
+
+#endif
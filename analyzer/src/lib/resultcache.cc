@@ -0,0 +1,147 @@
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "common.h"
+#include "resultcache.h"
+#include "sourcecache.h"
+
+// Bump when the analysis changes in a way that changes the reports
+static const char *CacheVersion = "mpirace-result-cache-10";
+
+ResultCache::ResultCache(StringRef Dir, const GlobalContext *Ctx)
+    : CacheDir(Dir.str()), NumHits(0), NumMisses(0) {
+    raw_string_ostream OS(Options);
+    OS << "mode " << (Ctx->DataflowMode ? "dataflow" : "per-call")
+       << (Ctx->Interprocedural ? " interprocedural" : "") << "\n"
+       << "budget " << Ctx->MaxFunctionBlocks << " " << Ctx->MaxCallBlocks
+       << " " << Ctx->FunctionTimeLimit << " " << Ctx->CallTimeLimit
+       << "\n";
+    OS.flush();
+    if (error_code EC = sys::fs::create_directories(CacheDir))
+        OP << "== Error: cannot create result cache directory "
+           << CacheDir << ": " << EC.message() << "\n";
+}
+
+string ResultCache::getEntryPath(StringRef Hash) {
+    return CacheDir + "/" + Hash.str();
+}
+
+/// Add the globals and functions a constant refers to
+static void collectGlobalRefs(Value *V, SetVector<GlobalValue *> &Refs,
+                              SmallPtrSet<Constant *, 16> &Visited) {
+    if (GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+        Refs.insert(GV);
+        return;
+    }
+    Constant *C = dyn_cast<Constant>(V);
+    if (!C || !Visited.insert(C).second)
+        return;
+    for (unsigned i = 0; i < C->getNumOperands(); ++i)
+        collectGlobalRefs(C->getOperand(i), Refs, Visited);
+}
+
+string ResultCache::hashFunction(Function *F, StringRef Context) {
+    MD5 Hash;
+    string Text;
+    raw_string_ostream OS(Text);
+
+    OS << CacheVersion << "\n" << Options;
+    // Number the metadata the way instructions of the reports are printed:
+    // the module globals first, then the function only
+    ModuleSlotTracker MST(F->getParent(),
+                          /*ShouldInitializeAllMetadata=*/false);
+    static_cast<Value *>(F)->print(OS, MST);
+
+    SetVector<GlobalValue *> Refs;
+    SmallPtrSet<Constant *, 16> Visited;
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt) {
+        for (BasicBlock::iterator it = bt->begin(), ie = bt->end();
+             it != ie; ++it) {
+            Instruction *I = &*it;
+            for (unsigned i = 0; i < I->getNumOperands(); ++i)
+                collectGlobalRefs(I->getOperand(i), Refs, Visited);
+
+            // Source lines are printed in the reports
+            DILocation *Loc = dyn_cast_or_null<DILocation>(
+                I->getMetadata(LLVMContext::MD_dbg));
+            if (!Loc)
+                continue;
+            string SrcPath =
+                Loc->getDirectory().str() + '/' + Loc->getFilename().str();
+            string SrcLine;
+            SourceFileCache::getInstance().getLine(SrcPath, Loc->getLine(),
+                                                   SrcLine);
+            OS << "loc " << SrcPath << ":" << Loc->getLine() << ":"
+               << Loc->getColumn() << ": " << SrcLine << "\n";
+        }
+    }
+
+    for (GlobalValue *GV : Refs) {
+        OS << (isa<Function>(GV) ? "func " : "global ") << GV->getName()
+           << " : " << *GV->getValueType();
+        if (GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV))
+            OS << (GVar->isConstant() ? " constant" : "");
+        else
+            OS << (GV->isDeclaration() ? " declaration" : "");
+        OS << "\n";
+    }
+    OS << Context;
+    OS.flush();
+
+    Hash.update(Text);
+    MD5::MD5Result Result;
+    Hash.final(Result);
+    SmallString<32> Digest;
+    MD5::stringifyResult(Result, Digest);
+    return Digest.str().str();
+}
+
+bool ResultCache::lookup(StringRef Hash, string &Report,
+                         vector<RaceRecord> &Races) {
+    ErrorOr<unique_ptr<MemoryBuffer>> BufOrErr =
+        MemoryBuffer::getFile(getEntryPath(Hash), /*IsText=*/false,
+                              /*RequiresNullTerminator=*/false);
+    if (BufOrErr) {
+        RecordReader R((*BufOrErr)->getBuffer());
+        Report = R.readString();
+        R.readRaceRecords(Races);
+        if (!R.Failed && R.atEnd()) {
+            ++NumHits;
+            return true;
+        }
+    }
+    Report.clear();
+    Races.clear();
+    ++NumMisses;
+    return false;
+}
+
+/// Write the entry to a temporary file first, so that concurrent runs
+/// sharing the cache never see a partial entry
+void ResultCache::store(StringRef Hash, StringRef Report,
+                        const vector<RaceRecord> &Races) {
+    int FD;
+    SmallString<128> TmpPath;
+    if (sys::fs::createUniqueFile(CacheDir + "/.tmp-%%%%%%%%", FD, TmpPath))
+        return;
+    {
+        raw_fd_ostream OS(FD, /*shouldClose=*/true);
+        support::endian::Writer W(OS, support::little);
+        writeEncodedString(W, Report);
+        writeRaceRecords(W, Races);
+    }
+    if (sys::fs::rename(TmpPath, getEntryPath(Hash)))
+        sys::fs::remove(TmpPath);
+}
+
+void ResultCache::printStats(void) {
+    OP << "== Result cache: " << NumHits << " hit(s), "
+       << NumMisses << " miss(es)\n";
+}
@@ -0,0 +1,47 @@
+#ifndef _RESULTCACHE_H_
+#define _RESULTCACHE_H_
+
+#include <atomic>
+#include <string>
+
+#include "llvm/IR/Function.h"
+
+#include "global.h"
+#include "report.h"
+
+/// On-disk cache of per-function race reports for incremental runs.
+/// Each entry holds the text report of a function and its race records,
+/// so that cached functions are also written to the -output file.
+/// Reports are keyed by a structural hash of the function, which covers
+/// everything the report of the function depends on: its instructions,
+/// the debug locations and source lines it prints, and the callees and
+/// globals it refers to. The options of the run that change reports are
+/// part of every key.
+class ResultCache {
+private:
+    string CacheDir;
+    string Options;
+    atomic<unsigned> NumHits;
+    atomic<unsigned> NumMisses;
+
+    string getEntryPath(StringRef);
+
+public:
+    ResultCache(StringRef Dir, const GlobalContext *);
+
+    /// Hash a function, along with anything else its report depends on,
+    /// e.g., the summaries of its callees. Metadata is numbered as in the
+    /// reports, from the module globals and the function alone, so that
+    /// editing another function does not change the hash.
+    string hashFunction(Function *, StringRef Context = "");
+
+    /// Look up the report of a function and the race records it found
+    bool lookup(StringRef Hash, string &Report, vector<RaceRecord> &Races);
+
+    void store(StringRef Hash, StringRef Report,
+               const vector<RaceRecord> &Races);
+
+    void printStats(void);
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+
+#include "rootpointer.h"
+#include "stats.h"
+
+RootPointerResolver::RootPointerResolver(Function *F) {
+    computeLocalStores(F);
+}
+
+/// One forward pass over each block to find the store that defines each
+/// load within its block, and the last store to each address
+void RootPointerResolver::computeLocalStores(Function *F) {
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt) {
+        BasicBlock *BB = &*bt;
+        DenseMap<Value *, StoreInst *> LastStores;
+        for (BasicBlock::iterator it = BB->begin(), ie = BB->end();
+             it != ie; ++it) {
+            Instruction *I = &*it;
+            if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+                LastStores[SI->getPointerOperand()] = SI;
+            } else if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+                StoreInst *SI = LastStores.lookup(LI->getPointerOperand());
+                if (SI)
+                    LocalStores[LI] = SI;
+            }
+        }
+        if (!LastStores.empty())
+            BlockLastStores[BB] = move(LastStores);
+    }
+}
+
+/// Walk the predecessors of BB breadth first, stopping each path at the
+/// last store to Addr in a block
+vector<StoreInst *> RootPointerResolver::getEntryStores(Value *Addr,
+                                                        BasicBlock *BB) {
+    lock_guard<mutex> Guard(Lock);
+    pair<Value *, BasicBlock *> Key = make_pair(Addr, BB);
+    DenseMap<pair<Value *, BasicBlock *>, vector<StoreInst *>>::iterator
+        it = EntryStores.find(Key);
+    if (it != EntryStores.end())
+        return it->second;
+
+    vector<StoreInst *> Stores;
+    SmallPtrSet<BasicBlock *, 16> visitedBBs;
+    vector<BasicBlock *> toBeVisitedBBs(pred_begin(BB), pred_end(BB));
+    for (unsigned i = 0; i < toBeVisitedBBs.size(); ++i) {
+        BasicBlock *curBB = toBeVisitedBBs[i];
+        if (!visitedBBs.insert(curBB).second)
+            continue;
+        DenseMap<BasicBlock *, DenseMap<Value *, StoreInst *>>::iterator
+            bit = BlockLastStores.find(curBB);
+        if (bit != BlockLastStores.end()) {
+            StoreInst *SI = bit->second.lookup(Addr);
+            if (SI) {
+                Stores.push_back(SI);
+                continue;
+            }
+        }
+        toBeVisitedBBs.insert(toBeVisitedBBs.end(),
+                              pred_begin(curBB), pred_end(curBB));
+    }
+
+    EntryStores[Key] = Stores;
+    return Stores;
+}
+
+void RootPointerResolver::collectRootPointers(Value *Ptr,
+                                              set<Value *> &RPtrs) {
+    addCounter(RootPointerWalksCounter);
+    SmallPtrSet<Value *, 8> Active;
+    resolve(Ptr, RPtrs, Active);
+}
+
+/// Memoized resolution. Returns false if the result is incomplete because
+/// it depends on a pointer that is still being resolved (a cycle through
+/// loads and stores), in which case it is not memoized.
+bool RootPointerResolver::resolve(Value *Ptr, set<Value *> &RPtrs,
+                                  SmallPtrSet<Value *, 8> &Active) {
+    {
+        lock_guard<mutex> Guard(Lock);
+        DenseMap<Value *, Resolution>::iterator it = Resolutions.find(Ptr);
+        if (it != Resolutions.end()) {
+            RPtrs.insert(it->second.Roots.begin(), it->second.Roots.end());
+            OP << it->second.Diagnostics;
+            return true;
+        }
+    }
+
+    if (!Active.insert(Ptr).second)
+        return false;
+
+    Resolution R;
+    bool Complete;
+    {
+        raw_string_ostream OS(R.Diagnostics);
+        raw_ostream *PrevOS = setOutputStream(&OS);
+        Complete = resolveUncached(Ptr, R.Roots, Active);
+        OS.flush();
+        setOutputStream(PrevOS);
+    }
+    Active.erase(Ptr);
+
+    RPtrs.insert(R.Roots.begin(), R.Roots.end());
+    OP << R.Diagnostics;
+    if (Complete) {
+        lock_guard<mutex> Guard(Lock);
+        Resolutions.insert(make_pair(Ptr, move(R)));
+    }
+    return Complete;
+}
+
+bool RootPointerResolver::resolveUncached(Value *Ptr, set<Value *> &RPtrs,
+                                          SmallPtrSet<Value *, 8> &Active) {
+    addCounter(ResolvedPointersCounter);
+    if (isa<AllocaInst>(Ptr) || isa<GlobalValue>(Ptr) ||
+        isa<ConstantPointerNull>(Ptr)) {
+        RPtrs.insert(Ptr);
+    } else if (BitCastInst *BCI = dyn_cast<BitCastInst>(Ptr)) {
+        return resolve(BCI->getOperand(0), RPtrs, Active);
+    } else if (GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(Ptr)) {
+        return resolve(GEPI->getPointerOperand(), RPtrs, Active);
+    } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(Ptr)) {
+        // Look through the expression in place rather than materializing
+        // it with getAsInstruction(), which mutates the use lists
+        if (CE->getOpcode() == Instruction::BitCast ||
+            CE->getOpcode() == Instruction::GetElementPtr)
+            return resolve(CE->getOperand(0), RPtrs, Active);
+        OP << KYEL "== Unsupported pointer in collectRootPointers(): \n"
+           <<  *Ptr << "\n" << KNRM;
+    } else if (CallBase *CI = dyn_cast<CallBase>(Ptr)) {
+        Function *CalledFunc = CI->getCalledFunction();
+        StringRef CalledFuncName = CalledFunc ? CalledFunc->getName() : "";
+        if (CalledFuncName.equals("malloc"))
+            RPtrs.insert(Ptr);
+        else if (isCPPSTLAPI(CalledFuncName))
+            RPtrs.insert(CI->getArgOperand(0));
+        else
+            OP << "== Error: unsupported call: " << *CI << "\n";
+    } else if (LoadInst *LI = dyn_cast<LoadInst>(Ptr)) {
+        // Find the store(s) to the same address that reach this load
+        if (StoreInst *SI = LocalStores.lookup(LI))
+            return resolve(SI->getValueOperand(), RPtrs, Active);
+        bool Complete = true;
+        vector<StoreInst *> Stores =
+            getEntryStores(LI->getPointerOperand(), LI->getParent());
+        for (StoreInst *SI : Stores)
+            Complete &= resolve(SI->getValueOperand(), RPtrs, Active);
+        return Complete;
+    } else
+        OP << KYEL "== Unsupported pointer in collectRootPointers(): \n"
+           <<  *Ptr << "\n" << KNRM;
+
+    return true;
+}
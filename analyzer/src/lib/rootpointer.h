@@ -0,0 +1,51 @@
+#ifndef _ROOTPOINTER_H_
+#define _ROOTPOINTER_H_
+
+#include <mutex>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+#include "common.h"
+
+/// Resolve pointers of a function to their root pointers (allocas,
+/// globals, heap allocations, ...). Store-to-load reaching definitions are
+/// computed once per function, and the roots of each pointer are memoized.
+/// The resolver may be queried concurrently.
+class RootPointerResolver {
+private:
+    struct Resolution {
+        set<Value *> Roots;
+        // Diagnostics printed while resolving, replayed on every query
+        // so that the output does not depend on the query order
+        string Diagnostics;
+    };
+
+    // Closest store to the same address before a load in its block
+    DenseMap<LoadInst *, StoreInst *> LocalStores;
+    // Last store to each address in a block
+    DenseMap<BasicBlock *, DenseMap<Value *, StoreInst *>> BlockLastStores;
+    // Stores to an address that reach the entry of a block, in the order
+    // of a breadth-first walk over the predecessors
+    DenseMap<pair<Value *, BasicBlock *>, vector<StoreInst *>> EntryStores;
+
+    DenseMap<Value *, Resolution> Resolutions;
+    mutex Lock;
+
+    void computeLocalStores(Function *);
+
+    vector<StoreInst *> getEntryStores(Value *, BasicBlock *);
+
+    bool resolve(Value *, set<Value *> &, SmallPtrSet<Value *, 8> &);
+
+    bool resolveUncached(Value *, set<Value *> &, SmallPtrSet<Value *, 8> &);
+
+public:
+    RootPointerResolver(Function *F);
+
+    void collectRootPointers(Value *, set<Value *> &);
+};
+
+#endif
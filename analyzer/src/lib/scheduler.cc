@@ -0,0 +1,103 @@
+#include "scheduler.h"
+
+// Worker identity of the current thread
+static thread_local WorkStealingPool *CurrentPool = NULL;
+static thread_local unsigned CurrentWorker = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned NumThreads)
+    : NumQueued(0), Stopping(false) {
+    // The thread that waits on a TaskGroup also runs tasks
+    unsigned NumWorkers = NumThreads > 1 ? NumThreads - 1 : 0;
+    for (unsigned i = 0; i <= NumWorkers; ++i)
+        Queues.push_back(unique_ptr<WorkQueue>(new WorkQueue()));
+    for (unsigned i = 0; i < NumWorkers; ++i)
+        Workers.push_back(thread(&WorkStealingPool::workerLoop, this, i));
+}
+
+WorkStealingPool::~WorkStealingPool(void) {
+    {
+        lock_guard<mutex> Guard(SleepLock);
+        Stopping = true;
+    }
+    WakeUp.notify_all();
+    for (auto &T : Workers)
+        T.join();
+}
+
+/// Queue owned by the current thread; non-worker threads share the last one
+unsigned WorkStealingPool::getQueueIndex(void) {
+    if (CurrentPool == this)
+        return CurrentWorker;
+    return Queues.size() - 1;
+}
+
+/// Pop from the back of our own queue, otherwise steal from the front
+/// of another queue
+bool WorkStealingPool::popTask(unsigned Self, QueuedTask &QT) {
+    unsigned NumQueues = Queues.size();
+    for (unsigned i = 0; i < NumQueues; ++i) {
+        unsigned Idx = (Self + i) % NumQueues;
+        WorkQueue &Q = *Queues[Idx];
+        lock_guard<mutex> Guard(Q.Lock);
+        if (Q.Tasks.empty())
+            continue;
+        if (Idx == Self) {
+            QT = move(Q.Tasks.back());
+            Q.Tasks.pop_back();
+        } else {
+            QT = move(Q.Tasks.front());
+            Q.Tasks.pop_front();
+        }
+        --NumQueued;
+        return true;
+    }
+    return false;
+}
+
+bool WorkStealingPool::tryRunOne(void) {
+    QueuedTask QT;
+    if (!popTask(getQueueIndex(), QT))
+        return false;
+    QT.Fn();
+    --QT.Group->Pending;
+    return true;
+}
+
+void WorkStealingPool::workerLoop(unsigned Idx) {
+    CurrentPool = this;
+    CurrentWorker = Idx;
+    while (true) {
+        if (tryRunOne())
+            continue;
+        unique_lock<mutex> Guard(SleepLock);
+        WakeUp.wait(Guard, [this]() {
+            return Stopping || NumQueued.load() > 0;
+        });
+        if (Stopping && NumQueued.load() == 0)
+            return;
+    }
+}
+
+void WorkStealingPool::async(TaskGroup &TG, Task Fn) {
+    ++TG.Pending;
+    WorkQueue &Q = *Queues[getQueueIndex()];
+    {
+        lock_guard<mutex> Guard(Q.Lock);
+        Q.Tasks.push_back(QueuedTask{move(Fn), &TG});
+        ++NumQueued;
+    }
+    {
+        // Pair with the predicate check in workerLoop()
+        lock_guard<mutex> Guard(SleepLock);
+    }
+    WakeUp.notify_one();
+}
+
+/// Wait until every task of the group has finished, running queued
+/// tasks (of any group) in the meantime
+void WorkStealingPool::wait(TaskGroup &TG) {
+    while (!TG.isDone()) {
+        if (!tryRunOne())
+            this_thread::yield();
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/// A set of tasks that can be waited on as a whole
+class TaskGroup {
+private:
+    atomic<unsigned> Pending;
+
+    friend class WorkStealingPool;
+
+public:
+    TaskGroup() : Pending(0) {}
+
+    bool isDone(void) {
+        return Pending.load() == 0;
+    }
+};
+
+/// A thread pool where each worker owns a deque of tasks. A worker pops
+/// its own tasks in LIFO order and steals from the other end of the
+/// other workers' deques when it runs out of work. Threads waiting on a
+/// TaskGroup keep executing queued tasks, so tasks may spawn and wait on
+/// subtasks without deadlocking the pool.
+class WorkStealingPool {
+public:
+    typedef function<void()> Task;
+
+private:
+    struct QueuedTask {
+        Task Fn;
+        TaskGroup *Group;
+    };
+
+    struct WorkQueue {
+        mutex Lock;
+        deque<QueuedTask> Tasks;
+    };
+
+    // One queue per worker, plus one shared by non-worker threads
+    vector<unique_ptr<WorkQueue>> Queues;
+    vector<thread> Workers;
+
+    mutex SleepLock;
+    condition_variable WakeUp;
+    atomic<unsigned> NumQueued;
+    bool Stopping;
+
+    unsigned getQueueIndex(void);
+
+    bool popTask(unsigned, QueuedTask &);
+
+    bool tryRunOne(void);
+
+    void workerLoop(unsigned);
+
+public:
+    /// Create a pool that runs tasks on \p NumThreads threads in total,
+    /// counting the thread that waits on the submitted tasks.
+    WorkStealingPool(unsigned NumThreads);
+
+    ~WorkStealingPool(void);
+
+    void async(TaskGroup &, Task);
+
+    void wait(TaskGroup &);
+};
+
+#endif
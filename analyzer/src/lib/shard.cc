@@ -0,0 +1,230 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include "loader.h"
+#include "mpirace.h"
+#include "report.h"
+#include "shard.h"
+
+/// Result of one input file as handed over by a worker
+struct ShardResult {
+    bool Done;
+    string Report;
+    vector<RaceRecord> Races;
+};
+
+/// Estimated cost of analyzing a file. The size of the bitcode grows with
+/// both the number of functions and their bodies.
+static uint64_t estimateCost(const string &File) {
+    uint64_t Size = 0;
+    if (sys::fs::file_size(File, Size))
+        return 0;
+    return Size;
+}
+
+/// Assign each file to the shard with the least cost so far, largest
+/// files first, so that the shards finish at about the same time. Ties
+/// are broken by position so that the assignment is deterministic.
+static void partitionFiles(const vector<string> &Files, unsigned NumShards,
+                           vector<vector<unsigned>> &Shards) {
+    vector<uint64_t> Costs(Files.size());
+    vector<unsigned> Order(Files.size());
+    for (unsigned i = 0; i < Files.size(); ++i) {
+        Costs[i] = estimateCost(Files[i]);
+        Order[i] = i;
+    }
+    stable_sort(Order.begin(), Order.end(), [&Costs](unsigned A, unsigned B) {
+        return Costs[A] > Costs[B];
+    });
+
+    Shards.assign(NumShards, vector<unsigned>());
+    vector<uint64_t> Loads(NumShards, 0);
+    for (unsigned i : Order) {
+        unsigned Min = 0;
+        for (unsigned s = 1; s < NumShards; ++s) {
+            if (Loads[s] < Loads[Min])
+                Min = s;
+        }
+        Shards[Min].push_back(i);
+        // Every file costs something, e.g., empty or missing ones
+        Loads[Min] += Costs[i] + 1;
+    }
+    for (vector<unsigned> &Shard : Shards)
+        llvm::sort(Shard);
+}
+
+/// Write the result of a file as one entry prefixed by its length, so
+/// that the parent can tell an entry cut short by a crash
+static void writeResult(raw_ostream &OS, unsigned Index, StringRef Report,
+                        const vector<RaceRecord> &Races) {
+    string Payload;
+    raw_string_ostream PS(Payload);
+    support::endian::Writer W(PS, support::little);
+    W.write<uint32_t>(Index);
+    writeEncodedString(W, Report);
+    writeRaceRecords(W, Races);
+    PS.flush();
+    support::endian::write<uint32_t>(OS, Payload.size(), support::little);
+    OS << Payload;
+    OS.flush();
+}
+
+/// Decoder of the entries of a worker. Reads past the end set Failed.
+class ShardResultReader : public RecordReader {
+public:
+    ShardResultReader(StringRef Data) : RecordReader(Data) {}
+
+    /// Read one entry into its slot of Results, false at the end of the
+    /// entries or at an entry the worker did not finish writing
+    bool readResult(vector<ShardResult> &Results) {
+        StringRef Payload = readBytes(read<uint32_t>());
+        if (Failed)
+            return false;
+        RecordReader P(Payload);
+        unsigned Index = P.read<uint32_t>();
+        if (P.Failed || Index >= Results.size())
+            return false;
+        ShardResult &SR = Results[Index];
+        SR.Report = P.readString();
+        P.readRaceRecords(SR.Races);
+        SR.Done = !P.Failed;
+        return SR.Done;
+    }
+};
+
+/// Analyze the files of a shard in the worker process and exit
+static void runShardWorker(GlobalContext *Ctx, const vector<string> &Files,
+                           const vector<unsigned> &Shard, int FD,
+                           bool Lazy) {
+    raw_fd_ostream Out(FD, /*shouldClose=*/true);
+    ReportWriter Kept;
+    if (Ctx->Reports)
+        Ctx->Reports = &Kept;
+    // Never destroyed, so that the worker prints nothing of its own
+    MPIRacePass *Pass = new MPIRacePass(Ctx);
+
+    for (unsigned i : Shard) {
+        string Report;
+        raw_string_ostream OS(Report);
+        raw_ostream *PrevOS = setOutputStream(&OS);
+        LLVMContext *LLVMCtx = new LLVMContext();
+        SMDiagnostic Err;
+        unique_ptr<Module> M = loadIRFile(Files[i], Err, *LLVMCtx, Lazy);
+        if (M)
+            Pass->runOnModule(M.get(), Files[i], i + 1, Files.size());
+        else
+            OP << "[MPIRacePass] error loading file '" << Files[i] << "\n";
+        M.reset();
+        delete LLVMCtx;
+        OS.flush();
+        setOutputStream(PrevOS);
+
+        vector<RaceRecord> Races;
+        Kept.takeRecords(Races);
+        writeResult(Out, i, Report, Races);
+    }
+    Out.close();
+    _exit(Out.has_error() ? 1 : 0);
+}
+
+/// Describe how a worker ended, empty if it finished normally
+static string describeExit(int Status) {
+    if (WIFEXITED(Status))
+        return WEXITSTATUS(Status)
+                   ? "exited with status " + to_string(WEXITSTATUS(Status))
+                   : "";
+    if (WIFSIGNALED(Status))
+        return "killed by signal " + to_string(WTERMSIG(Status));
+    return "stopped";
+}
+
+bool runShards(GlobalContext *Ctx, const vector<string> &Files,
+               unsigned NumShards, bool Lazy) {
+    vector<vector<unsigned>> Shards;
+    partitionFiles(Files, NumShards, Shards);
+
+    vector<SmallString<128>> ResultFiles(Shards.size());
+    vector<pid_t> Workers(Shards.size(), -1);
+    // Output buffered in the parent would be printed again by each worker
+    OP.flush();
+    for (unsigned s = 0; s < Shards.size(); ++s) {
+        if (Shards[s].empty())
+            continue;
+        int FD;
+        if (error_code EC = sys::fs::createTemporaryFile(
+                "mpirace-shard", "bin", FD, ResultFiles[s])) {
+            OP << "== Error: cannot create shard result file: "
+               << EC.message() << "\n";
+            return false;
+        }
+        pid_t Pid = fork();
+        if (Pid == 0)
+            runShardWorker(Ctx, Files, Shards[s], FD, Lazy);
+        close(FD);
+        if (Pid < 0) {
+            OP << "== Error: cannot start worker of shard " << s << ": "
+               << strerror(errno) << "\n";
+            return false;
+        }
+        Workers[s] = Pid;
+    }
+
+    vector<string> Failures(Shards.size());
+    vector<ShardResult> Results(Files.size());
+    for (ShardResult &SR : Results)
+        SR.Done = false;
+    for (unsigned s = 0; s < Shards.size(); ++s) {
+        if (Workers[s] < 0)
+            continue;
+        int Status = 0;
+        while (waitpid(Workers[s], &Status, 0) < 0 && errno == EINTR)
+            ;
+        Failures[s] = describeExit(Status);
+
+        // The entries of the files the worker finished are complete
+        ErrorOr<unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(
+            ResultFiles[s], /*IsText=*/false,
+            /*RequiresNullTerminator=*/false);
+        if (Buf) {
+            ShardResultReader R((*Buf)->getBuffer());
+            while (!R.atEnd() && R.readResult(Results))
+                ;
+        }
+        sys::fs::remove(ResultFiles[s]);
+    }
+
+    for (unsigned i = 0; i < Results.size(); ++i) {
+        if (!Results[i].Done)
+            continue;
+        OP << Results[i].Report;
+        if (Ctx->Reports)
+            Ctx->Reports->write(Results[i].Races);
+    }
+    unsigned NumFailed = 0;
+    for (unsigned s = 0; s < Shards.size(); ++s) {
+        if (Failures[s].empty())
+            continue;
+        ++NumFailed;
+        OP << "== Shard " << s << " " << Failures[s] << ", not analyzed:";
+        for (unsigned i : Shards[s]) {
+            if (!Results[i].Done)
+                OP << " " << Files[i];
+        }
+        OP << "\n";
+    }
+
+    OP << "[MPIRacePass] Done!\n\n";
+    if (NumFailed)
+        OP << "== " << NumFailed << " of " << Shards.size()
+           << " shard(s) failed\n";
+    OP << "== Done ==\n";
+    return NumFailed == 0;
+}
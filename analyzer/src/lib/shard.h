@@ -0,0 +1,20 @@
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+#include <string>
+#include <vector>
+
+#include "global.h"
+
+/// Detect data races in worker processes, one per shard of the input
+/// files. Files are assigned to shards by estimated cost, largest first,
+/// and each worker runs the pass on the modules of its shard as in the
+/// streaming mode, handing the report and the race records of each
+/// module to the parent through a temporary file. The parent prints the
+/// reports and writes the records in input order, so the output does not
+/// depend on the shards. A worker that crashes only loses the modules of
+/// its shard it had not finished. Returns false if a worker failed.
+bool runShards(GlobalContext *, const vector<string> &Files,
+               unsigned NumShards, bool Lazy);
+
+#endif
@@ -0,0 +1,81 @@
+#include "llvm/Support/FileSystem.h"
+
+#include "sourcecache.h"
+
+SourceFileCache &SourceFileCache::getInstance(void) {
+    static SourceFileCache Cache;
+    return Cache;
+}
+
+/// Read a file unless the entry read in a previous generation is still
+/// current. Failures are cached until the next generation.
+shared_ptr<SourceFileCache::SourceFile>
+SourceFileCache::getFile(StringRef Path) {
+    StringMap<shared_ptr<SourceFile>>::iterator it = Files.find(Path);
+    if (it != Files.end() && it->second->Checked == Generation)
+        return it->second;
+
+    sys::fs::file_status Status;
+    Expected<sys::fs::file_t> FD = sys::fs::openNativeFileForRead(Path);
+    bool Opened = (bool)FD;
+    if (!Opened)
+        consumeError(FD.takeError());
+    bool HasStatus = Opened && !sys::fs::status(*FD, Status);
+
+    if (it != Files.end() && it->second->Buffer && HasStatus &&
+        it->second->ModTime == Status.getLastModificationTime() &&
+        it->second->Size == Status.getSize()) {
+        sys::fs::closeFile(*FD);
+        it->second->Checked = Generation;
+        return it->second;
+    }
+
+    shared_ptr<SourceFile> SF(new SourceFile());
+    SF->Size = 0;
+    SF->Checked = Generation;
+    if (HasStatus) {
+        ErrorOr<unique_ptr<MemoryBuffer>> BufOrErr =
+            MemoryBuffer::getOpenFile(*FD, Path, Status.getSize(),
+                                      /*RequiresNullTerminator=*/false,
+                                      /*IsVolatile=*/true);
+        if (BufOrErr) {
+            SF->Buffer = move(*BufOrErr);
+            SF->ModTime = Status.getLastModificationTime();
+            SF->Size = Status.getSize();
+            StringRef Content = SF->Buffer->getBuffer();
+            if (!Content.empty())
+                SF->LineOffsets.push_back(0);
+            for (size_t i = 0; i < Content.size(); ++i) {
+                if (Content[i] == '\n' && i + 1 < Content.size())
+                    SF->LineOffsets.push_back(i + 1);
+            }
+        }
+    }
+    if (Opened)
+        sys::fs::closeFile(*FD);
+
+    Files[Path] = SF;
+    return SF;
+}
+
+bool SourceFileCache::getLine(StringRef Path, unsigned LineNo,
+                              string &Line) {
+    shared_ptr<SourceFile> SF;
+    {
+        lock_guard<mutex> Guard(Lock);
+        SF = getFile(Path);
+    }
+    if (!SF->Buffer || LineNo < 1 || LineNo > SF->LineOffsets.size())
+        return false;
+
+    StringRef Content = SF->Buffer->getBuffer();
+    size_t Start = SF->LineOffsets[LineNo - 1];
+    size_t End = Content.find('\n', Start);
+    Line = Content.slice(Start, End).str();
+    return true;
+}
+
+void SourceFileCache::revalidate(void) {
+    lock_guard<mutex> Guard(Lock);
+    ++Generation;
+}
@@ -0,0 +1,57 @@
+#ifndef _SOURCECACHE_H_
+#define _SOURCECACHE_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace llvm;
+using namespace std;
+
+/// Process-wide cache of source files used to print the source lines of
+/// reported instructions. Each file is read once, and its line offsets are
+/// indexed so that a line lookup does not touch the file system again.
+/// Files are copied into memory rather than mapped, so that a file
+/// truncated under a long-running process cannot fault it.
+class SourceFileCache {
+private:
+    struct SourceFile {
+        // NULL if the file cannot be read
+        unique_ptr<MemoryBuffer> Buffer;
+        // Offset of the first character of each line
+        vector<size_t> LineOffsets;
+        // Modification time and size of the file when it was read
+        sys::TimePoint<> ModTime;
+        uint64_t Size;
+        // Generation in which the file was last checked for changes
+        unsigned Checked;
+    };
+
+    mutex Lock;
+    unsigned Generation;
+    // Entries are shared with the lookups in flight when a changed file
+    // replaces them
+    StringMap<shared_ptr<SourceFile>> Files;
+
+    SourceFileCache(void) : Generation(0) {}
+
+    shared_ptr<SourceFile> getFile(StringRef);
+
+public:
+    static SourceFileCache &getInstance(void);
+
+    /// Get line LineNo (starting from 1) of a file, without the trailing
+    /// newline. Returns false if the file cannot be read or is shorter.
+    bool getLine(StringRef Path, unsigned LineNo, string &Line);
+
+    /// Check the files for changes, including those that could not be
+    /// read, on their next lookup, e.g., before each request of a daemon
+    void revalidate(void);
+};
+
+#endif
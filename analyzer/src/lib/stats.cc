@@ -0,0 +1,237 @@
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+
+#include "stats.h"
+
+static const char *PhaseNames[NumPhases] = {
+    "parse", "collectMPICalls", "summarize", "buildIndexes", "identifyWaitCalls",
+    "raceWindow", "checkBufferOverlap"
+};
+
+static const char *CounterNames[NumCounters] = {
+    "functions", "nonblocking calls", "blocks visited", "overlap checks",
+    "root pointer walks", "pointers resolved", "functions summarized",
+    "functions incomplete", "functions skipped", "files skipped"
+};
+
+// Slowest functions printed in the summary
+static const unsigned NumSlowest = 10;
+
+struct TraceEvent {
+    string Name;
+    string Detail;
+    // Phase of the event, NumPhases for a function
+    AnalysisPhase Phase;
+    uint64_t Start;
+    uint64_t Duration;
+};
+
+struct FunctionTime {
+    uint64_t Duration;
+    string Name;
+    string Module;
+};
+
+/// Statistics of one thread. They are owned by the global list, so they
+/// are still around when the thread exits.
+struct ThreadStats {
+    unsigned ThreadId;
+    uint64_t PhaseTimes[NumPhases];
+    uint64_t PhaseCounts[NumPhases];
+    uint64_t Counters[NumCounters];
+    vector<TraceEvent> Events;
+    vector<FunctionTime> Functions;
+
+    ThreadStats(unsigned Id) : ThreadId(Id) {
+        for (unsigned i = 0; i < NumPhases; ++i)
+            PhaseTimes[i] = PhaseCounts[i] = 0;
+        for (unsigned i = 0; i < NumCounters; ++i)
+            Counters[i] = 0;
+    }
+};
+
+static bool StatsEnabled = false;
+static bool TraceEnabled = false;
+static chrono::steady_clock::time_point StartTime;
+
+static mutex StatsLock;
+static vector<unique_ptr<ThreadStats>> AllStats;
+static thread_local ThreadStats *LocalStats = NULL;
+
+static ThreadStats &getThreadStats(void) {
+    if (!LocalStats) {
+        lock_guard<mutex> Guard(StatsLock);
+        AllStats.emplace_back(new ThreadStats(AllStats.size()));
+        LocalStats = AllStats.back().get();
+    }
+    return *LocalStats;
+}
+
+/// Microseconds since statistics were enabled
+static uint64_t getTimestamp(chrono::steady_clock::time_point T) {
+    return chrono::duration_cast<chrono::microseconds>(T - StartTime)
+        .count();
+}
+
+void enableStatistics(bool Trace) {
+    StatsEnabled = true;
+    TraceEnabled = Trace;
+    StartTime = chrono::steady_clock::now();
+}
+
+bool isStatisticsEnabled(void) {
+    return StatsEnabled;
+}
+
+void addCounter(AnalysisCounter C, uint64_t N) {
+    getThreadStats().Counters[C] += N;
+}
+
+uint64_t getCounter(AnalysisCounter C) {
+    lock_guard<mutex> Guard(StatsLock);
+    uint64_t Total = 0;
+    for (unique_ptr<ThreadStats> &TS : AllStats)
+        Total += TS->Counters[C];
+    return Total;
+}
+
+PhaseTimer::PhaseTimer(AnalysisPhase Phase_, StringRef Detail_)
+    : Phase(Phase_), Detail(Detail_), Enabled(StatsEnabled) {
+    if (Enabled)
+        Start = chrono::steady_clock::now();
+}
+
+PhaseTimer::~PhaseTimer(void) {
+    if (!Enabled)
+        return;
+    chrono::steady_clock::time_point End = chrono::steady_clock::now();
+    ThreadStats &TS = getThreadStats();
+    uint64_t Begin = getTimestamp(Start);
+    uint64_t Duration = getTimestamp(End) - Begin;
+    TS.PhaseTimes[Phase] += Duration;
+    ++TS.PhaseCounts[Phase];
+    if (TraceEnabled)
+        TS.Events.push_back({PhaseNames[Phase], Detail.str(), Phase, Begin,
+                             Duration});
+}
+
+FunctionTimer::FunctionTimer(StringRef Name_, StringRef Module_)
+    : Module(Module_), Enabled(StatsEnabled) {
+    if (!Enabled)
+        return;
+    Name = Name_.str();
+    Start = chrono::steady_clock::now();
+}
+
+FunctionTimer::~FunctionTimer(void) {
+    if (!Enabled)
+        return;
+    chrono::steady_clock::time_point End = chrono::steady_clock::now();
+    ThreadStats &TS = getThreadStats();
+    uint64_t Begin = getTimestamp(Start);
+    uint64_t Duration = getTimestamp(End) - Begin;
+    TS.Functions.push_back({Duration, Name, Module.str()});
+    if (TraceEnabled)
+        TS.Events.push_back({Name, Module.str(), NumPhases, Begin, Duration});
+}
+
+void printStatistics(raw_ostream &OS) {
+    lock_guard<mutex> Guard(StatsLock);
+    uint64_t PhaseTimes[NumPhases] = {0};
+    uint64_t PhaseCounts[NumPhases] = {0};
+    uint64_t Counters[NumCounters] = {0};
+    vector<FunctionTime *> Functions;
+    for (unique_ptr<ThreadStats> &TS : AllStats) {
+        for (unsigned i = 0; i < NumPhases; ++i) {
+            PhaseTimes[i] += TS->PhaseTimes[i];
+            PhaseCounts[i] += TS->PhaseCounts[i];
+        }
+        for (unsigned i = 0; i < NumCounters; ++i)
+            Counters[i] += TS->Counters[i];
+        for (FunctionTime &FT : TS->Functions)
+            Functions.push_back(&FT);
+    }
+
+    OS << "== Analysis statistics (" << AllStats.size() << " threads):\n";
+    if (StatsEnabled) {
+        OS << "   phase                    time (s)      count     avg (us)\n";
+        for (unsigned i = 0; i < NumPhases; ++i)
+            OS << format("   %-20s %12.3f %10llu %12.1f\n", PhaseNames[i],
+                         PhaseTimes[i] / 1e6,
+                         (unsigned long long)PhaseCounts[i],
+                         PhaseCounts[i] ? (double)PhaseTimes[i] /
+                                              PhaseCounts[i]
+                                        : 0.0);
+    }
+    OS << "   counter                     value\n";
+    for (unsigned i = 0; i < NumCounters; ++i)
+        OS << format("   %-20s %12llu\n", CounterNames[i],
+                     (unsigned long long)Counters[i]);
+
+    if (Functions.empty())
+        return;
+    // Ties are broken by name so that the list is stable
+    unsigned N = min((unsigned)Functions.size(), NumSlowest);
+    partial_sort(Functions.begin(), Functions.begin() + N, Functions.end(),
+                 [](FunctionTime *A, FunctionTime *B) {
+                     if (A->Duration != B->Duration)
+                         return A->Duration > B->Duration;
+                     return A->Name < B->Name;
+                 });
+    OS << "== Slowest functions:\n";
+    for (unsigned i = 0; i < N; ++i)
+        OS << format("   %12.3f s  ", Functions[i]->Duration / 1e6)
+           << Functions[i]->Name << " (" << Functions[i]->Module << ")\n";
+}
+
+bool writeChromeTrace(StringRef File) {
+    error_code EC;
+    raw_fd_ostream OS(File, EC, sys::fs::OF_Text);
+    if (EC)
+        return false;
+
+    lock_guard<mutex> Guard(StatsLock);
+    json::OStream J(OS);
+    J.object([&] {
+        J.attribute("displayTimeUnit", "ms");
+        J.attributeArray("traceEvents", [&] {
+            for (unique_ptr<ThreadStats> &TS : AllStats) {
+                J.object([&] {
+                    J.attribute("ph", "M");
+                    J.attribute("name", "thread_name");
+                    J.attribute("pid", 1);
+                    J.attribute("tid", (int64_t)TS->ThreadId);
+                    J.attributeObject("args", [&] {
+                        J.attribute("name",
+                                    "thread " + to_string(TS->ThreadId));
+                    });
+                });
+                for (TraceEvent &E : TS->Events) {
+                    J.object([&] {
+                        J.attribute("ph", "X");
+                        J.attribute("name", E.Name);
+                        J.attribute("cat", E.Phase == NumPhases
+                                               ? "function" : "phase");
+                        J.attribute("pid", 1);
+                        J.attribute("tid", (int64_t)TS->ThreadId);
+                        J.attribute("ts", (int64_t)E.Start);
+                        J.attribute("dur", (int64_t)E.Duration);
+                        if (!E.Detail.empty()) {
+                            J.attributeObject("args", [&] {
+                                J.attribute("detail", E.Detail);
+                            });
+                        }
+                    });
+                }
+            }
+        });
+    });
+    OS << "\n";
+    return true;
+}
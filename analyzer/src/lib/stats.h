@@ -0,0 +1,95 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <chrono>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+
+enum AnalysisPhase {
+    ParsePhase,
+    CollectCallsPhase,
+    // Interprocedural summaries of a module
+    SummaryPhase,
+    // Dominators, loops, reachability, root pointers and requests
+    IndexPhase,
+    WaitCallsPhase,
+    RaceWindowPhase,
+    OverlapPhase,
+    NumPhases
+};
+
+enum AnalysisCounter {
+    FunctionsCounter,
+    NonblockingCallsCounter,
+    VisitedBlocksCounter,
+    // Intervals compared against a queried buffer
+    OverlapChecksCounter,
+    RootPointerWalksCounter,
+    // Pointers resolved to their roots without the memo
+    ResolvedPointersCounter,
+    SummarizedFunctionsCounter,
+    // Functions whose analysis ran out of budget, or was not started
+    // before the deadline
+    IncompleteFunctionsCounter,
+    SkippedFunctionsCounter,
+    // Input files not parsed or not analyzed before the deadline
+    SkippedFilesCounter,
+    NumCounters
+};
+
+/// Start timing the phases. With a trace, every timed region is also
+/// recorded as an event of its thread.
+void enableStatistics(bool Trace);
+
+bool isStatisticsEnabled(void);
+
+/// Add to a counter of the current thread. Counters are always kept, as
+/// they are cheap, and summed over the threads when printed.
+void addCounter(AnalysisCounter, uint64_t N = 1);
+
+uint64_t getCounter(AnalysisCounter);
+
+/// Time a phase of the analysis while in scope, if statistics are
+/// enabled. Detail names the traced event, e.g., the function.
+class PhaseTimer {
+private:
+    AnalysisPhase Phase;
+    StringRef Detail;
+    bool Enabled;
+    chrono::steady_clock::time_point Start;
+
+public:
+    PhaseTimer(AnalysisPhase, StringRef Detail = "");
+
+    ~PhaseTimer(void);
+};
+
+/// Time the analysis of a function while in scope, to find the slowest
+/// functions, and trace it as an event enclosing its phases
+class FunctionTimer {
+private:
+    string Name;
+    StringRef Module;
+    bool Enabled;
+    chrono::steady_clock::time_point Start;
+
+public:
+    FunctionTimer(StringRef Name, StringRef Module);
+
+    ~FunctionTimer(void);
+};
+
+/// Print the time and count of each phase, the counters and the slowest
+/// functions over all threads
+void printStatistics(raw_ostream &);
+
+/// Write the recorded events as a Chrome trace (chrome://tracing or
+/// Perfetto). Returns false if the file cannot be written.
+bool writeChromeTrace(StringRef File);
+
+#endif
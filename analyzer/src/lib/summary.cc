@@ -0,0 +1,563 @@
+#include <tuple>
+
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+
+#include "scheduler.h"
+#include "stats.h"
+#include "summary.h"
+#include "summaryindex.h"
+
+// Rounds of a recursive component before giving up on a fixed point
+static const unsigned MaxSCCIterations = 8;
+// Accesses kept per summary before they are widened to whole objects
+static const unsigned MaxSummaryAccesses = 32;
+// Calls to other modules kept per summary
+static const unsigned MaxExternalCalls = 16;
+
+bool SummaryAccess::operator==(const SummaryAccess &A) const {
+    return Param == A.Param && Global == A.Global && Offset == A.Offset &&
+           Size == A.Size && IsWrite == A.IsWrite && IsElement == A.IsElement;
+}
+
+void SummaryAccess::locate(CallBase *CI, const DataLayout &DL,
+                           BufferAccess &A) const {
+    Value *Ptr = Param < 0 ? CI->getModule()->getNamedGlobal(Global)
+                           : CI->getArgOperand(Param);
+    BufferOverlapIndex::getLocation(Ptr, DL, A);
+    A.Inst = CI;
+    A.Offset += Offset;
+    A.Size = Size;
+    A.IsWrite = IsWrite;
+    A.IsElement |= IsElement;
+}
+
+bool SummaryRequest::operator==(const SummaryRequest &R) const {
+    return RequestParam == R.RequestParam && Buffer == R.Buffer;
+}
+
+bool SummaryWait::operator==(const SummaryWait &W) const {
+    return RequestParam == W.RequestParam && CountParam == W.CountParam &&
+           Single == W.Single;
+}
+
+bool SummaryOperand::operator==(const SummaryOperand &O) const {
+    return Located == O.Located && (!Located || Loc == O.Loc) &&
+           Param == O.Param && IsOne == O.IsOne;
+}
+
+bool SummaryCall::operator==(const SummaryCall &C) const {
+    return Callee == C.Callee && Operands == C.Operands;
+}
+
+bool CallSummary::operator==(const CallSummary &S) const {
+    return Accesses == S.Accesses && Started == S.Started &&
+           Completed == S.Completed && ExternalCalls == S.ExternalCalls;
+}
+
+MPIAPIKind CallSummary::getKind(void) const {
+    if (Started.size() == 1 && Completed.empty())
+        return MPINonblockingAPI;
+    if (Completed.size() == 1 && Started.empty())
+        return MPIWaitAPI;
+    return NotMPIAPI;
+}
+
+bool CallSummary::mayAccess(bool WritesOnly) const {
+    for (const SummaryAccess &A : Accesses) {
+        if (!WritesOnly || A.IsWrite)
+            return true;
+    }
+    return false;
+}
+
+void CallSummary::getCallAccesses(CallBase *CI, const DataLayout &DL,
+                                  SmallVectorImpl<BufferAccess> &As) const {
+    for (const SummaryAccess &SA : Accesses) {
+        BufferAccess A;
+        SA.locate(CI, DL, A);
+        As.push_back(A);
+    }
+}
+
+/// Express an access of a callee through one of its parameters relative
+/// to the caller, through the operand passed as the parameter
+static bool translateAccess(ArrayRef<SummaryOperand> Ops,
+                            const SummaryAccess &CA, SummaryAccess &SA) {
+    if (CA.Param < 0) {
+        SA = CA;
+        return true;
+    }
+    if ((unsigned)CA.Param >= Ops.size() || !Ops[CA.Param].Located)
+        return false;
+    const SummaryAccess &Loc = Ops[CA.Param].Loc;
+    SA = CA;
+    SA.Param = Loc.Param;
+    SA.Global = Loc.Global;
+    SA.IsElement |= Loc.IsElement;
+    if (Loc.Size == UnboundedSize || CA.Size == UnboundedSize) {
+        SA.Offset = 0;
+        SA.Size = UnboundedSize;
+    } else
+        SA.Offset = Loc.Offset + CA.Offset;
+    return true;
+}
+
+/// Get the parameter of the caller passed as a parameter of the callee
+static int translateParam(ArrayRef<SummaryOperand> Ops, int Param) {
+    if (Param < 0 || (unsigned)Param >= Ops.size())
+        return -1;
+    return Ops[Param].Param;
+}
+
+void CallSummary::addCall(ArrayRef<SummaryOperand> Ops,
+                          const CallSummary &Callee) {
+    for (const SummaryAccess &CA : Callee.Accesses) {
+        SummaryAccess SA;
+        if (translateAccess(Ops, CA, SA))
+            Accesses.push_back(SA);
+    }
+    for (const SummaryRequest &CR : Callee.Started) {
+        SummaryRequest SR;
+        int Req = translateParam(Ops, CR.RequestParam);
+        if (Req < 0 || !translateAccess(Ops, CR.Buffer, SR.Buffer))
+            continue;
+        SR.RequestParam = Req;
+        Started.push_back(SR);
+    }
+    for (const SummaryWait &CW : Callee.Completed) {
+        int Req = translateParam(Ops, CW.RequestParam);
+        if (Req < 0)
+            continue;
+        SummaryWait SW = CW;
+        SW.RequestParam = Req;
+        if (CW.CountParam >= 0) {
+            SW.CountParam = translateParam(Ops, CW.CountParam);
+            SW.Single = (unsigned)CW.CountParam < Ops.size() &&
+                        Ops[CW.CountParam].IsOne;
+        }
+        Completed.push_back(SW);
+    }
+    for (const SummaryCall &CC : Callee.ExternalCalls) {
+        SummaryCall SC;
+        SC.Callee = CC.Callee;
+        for (const SummaryOperand &CO : CC.Operands) {
+            SummaryOperand SO;
+            SO.Located = CO.Located && translateAccess(Ops, CO.Loc, SO.Loc);
+            SO.Param = translateParam(Ops, CO.Param);
+            SO.IsOne = CO.IsOne || (CO.Param >= 0 &&
+                                    (unsigned)CO.Param < Ops.size() &&
+                                    Ops[CO.Param].IsOne);
+            SC.Operands.push_back(SO);
+        }
+        ExternalCalls.push_back(SC);
+    }
+}
+
+void CallSummary::normalize(void) {
+    if (Accesses.size() > MaxSummaryAccesses) {
+        for (SummaryAccess &A : Accesses) {
+            A.Offset = 0;
+            A.Size = UnboundedSize;
+            A.IsElement = true;
+        }
+    }
+    auto Key = [](const SummaryAccess &A) {
+        return make_tuple(A.Param, A.Global, A.Offset, A.Size, A.IsWrite,
+                          A.IsElement);
+    };
+    llvm::sort(Accesses, [&](const SummaryAccess &A, const SummaryAccess &B) {
+        return Key(A) < Key(B);
+    });
+    Accesses.erase(unique(Accesses.begin(), Accesses.end()), Accesses.end());
+
+    SmallVector<SummaryRequest, 1> NewStarted;
+    SmallVector<SummaryWait, 1> NewCompleted;
+    for (SummaryRequest &R : Started) {
+        bool Waited = false;
+        for (SummaryWait &W : Completed)
+            Waited |= W.RequestParam == R.RequestParam;
+        if (!Waited && !is_contained(NewStarted, R))
+            NewStarted.push_back(R);
+    }
+    for (SummaryWait &W : Completed) {
+        bool Restarted = false;
+        for (SummaryRequest &R : Started)
+            Restarted |= W.RequestParam == R.RequestParam;
+        if (!Restarted && !is_contained(NewCompleted, W))
+            NewCompleted.push_back(W);
+    }
+    Started = move(NewStarted);
+    Completed = move(NewCompleted);
+
+    // Calls beyond the limit are not followed across modules
+    SmallVector<SummaryCall, 2> NewCalls;
+    for (SummaryCall &C : ExternalCalls) {
+        if (NewCalls.size() < MaxExternalCalls && !is_contained(NewCalls, C))
+            NewCalls.push_back(C);
+    }
+    ExternalCalls = move(NewCalls);
+}
+
+static void printAccess(raw_ostream &OS, const SummaryAccess &A) {
+    if (A.Param < 0)
+        OS << "@" << A.Global;
+    else
+        OS << "%" << A.Param;
+    if (A.Size == UnboundedSize)
+        OS << "[*]";
+    else
+        OS << "[" << A.Offset << ", +" << A.Size << ")";
+    OS << (A.IsWrite ? " write" : " read")
+       << (A.IsElement ? " element" : "");
+}
+
+void CallSummary::print(raw_ostream &OS) const {
+    for (const SummaryAccess &A : Accesses) {
+        OS << "  access ";
+        printAccess(OS, A);
+        OS << "\n";
+    }
+    for (const SummaryRequest &R : Started) {
+        OS << "  start %" << R.RequestParam << " on ";
+        printAccess(OS, R.Buffer);
+        OS << "\n";
+    }
+    for (const SummaryWait &W : Completed) {
+        OS << "  wait %" << W.RequestParam << " count ";
+        if (W.CountParam >= 0)
+            OS << "%" << W.CountParam;
+        else
+            OS << (W.Single ? "1" : "?");
+        OS << "\n";
+    }
+}
+
+SummaryEngine::SummaryEngine(Module *M_, WorkStealingPool *P,
+                             const CombinedSummaryIndex *I)
+    : M(M_), Pool(P), Imports(I) {
+}
+
+/// Express a pointer of a function relative to one of its parameters or
+/// a named global. Pointers derived through a variable index may access
+/// any byte of the object.
+bool SummaryEngine::getSummaryLocation(const DataLayout &DL, Value *Ptr,
+                                       uint64_t Size, bool IsWrite,
+                                       SummaryAccess &SA) {
+    BufferAccess A;
+    BufferOverlapIndex::getLocation(Ptr, DL, A);
+    Value *Base = A.Base;
+    SA.Offset = A.Offset;
+    SA.Size = Size;
+    SA.IsWrite = IsWrite;
+    SA.IsElement = A.IsElement;
+    if (!isa<Argument>(Base) && !isa<GlobalVariable>(Base)) {
+        Base = getUnderlyingObject(Base);
+        SA.Offset = 0;
+        SA.Size = UnboundedSize;
+        SA.IsElement = true;
+    }
+    if (Argument *Arg = dyn_cast<Argument>(Base)) {
+        SA.Param = Arg->getArgNo();
+        SA.Global = "";
+        return true;
+    }
+    GlobalVariable *GV = dyn_cast<GlobalVariable>(Base);
+    if (GV && GV->hasName()) {
+        SA.Param = -1;
+        SA.Global = GV->getName();
+        return true;
+    }
+    return false;
+}
+
+void SummaryEngine::getCallOperands(const DataLayout &DL, CallBase *CI,
+                                    SmallVectorImpl<SummaryOperand> &Ops) {
+    for (unsigned i = 0; i < CI->arg_size(); ++i) {
+        Value *V = CI->getArgOperand(i);
+        SummaryOperand Op;
+        Op.Located = V->getType()->isPointerTy() &&
+                     getSummaryLocation(DL, V, 0, false, Op.Loc);
+        Argument *Arg = dyn_cast<Argument>(V->stripPointerCasts());
+        Op.Param = Arg ? (int)Arg->getArgNo() : -1;
+        ConstantInt *C = dyn_cast<ConstantInt>(V);
+        Op.IsOne = C && C->isOne();
+        Ops.push_back(Op);
+    }
+}
+
+void SummaryEngine::addAccess(const DataLayout &DL, CallSummary &S,
+                              Value *Ptr, uint64_t Size, bool IsWrite) {
+    SummaryAccess SA;
+    if (getSummaryLocation(DL, Ptr, Size, IsWrite, SA))
+        S.Accesses.push_back(SA);
+}
+
+/// Add the buffer of an MPI call, and the requests it starts or completes
+/// through the parameters
+void SummaryEngine::addMPICall(const DataLayout &DL, CallSummary &S,
+                               CallBase *CI, StringRef Name) {
+    const MPIAPISpec *Spec = lookupMPIAPI(Name);
+    if (!Spec)
+        return;
+    switch (Spec->Kind) {
+    case MPINonblockingAPI: {
+        Value *Buf = CI->getArgOperand(Spec->Buffer);
+        uint64_t Size = parseAccessSize(CI->getArgOperand(Spec->Count),
+                                        CI->getArgOperand(Spec->Datatype));
+        SummaryRequest SR;
+        if (!getSummaryLocation(DL, Buf, Size, Spec->isBufferWrite(),
+                                SR.Buffer))
+            break;
+        S.Accesses.push_back(SR.Buffer);
+        Argument *Req = dyn_cast<Argument>(
+            CI->getArgOperand(Spec->Request)->stripPointerCasts());
+        if (Req) {
+            SR.RequestParam = Req->getArgNo();
+            S.Started.push_back(SR);
+        }
+        break;
+    }
+    case MPIBlockingAPI:
+        addAccess(DL, S, CI->getArgOperand(Spec->Buffer),
+                  parseAccessSize(CI->getArgOperand(Spec->Count),
+                                  CI->getArgOperand(Spec->Datatype)),
+                  Spec->isBufferWrite());
+        if (Spec->hasRecvBuffer())
+            addAccess(DL, S, CI->getArgOperand(Spec->RecvBuffer),
+                      parseAccessSize(CI->getArgOperand(Spec->RecvCount),
+                                      CI->getArgOperand(Spec->RecvDatatype)),
+                      true);
+        break;
+    case MPIWaitAPI: {
+        SummaryWait SW;
+        SW.CountParam = -1;
+        SW.Single = true;
+        if (Spec->Completion == MPICompleteAll) {
+            Value *Count = CI->getArgOperand(Spec->RequestCount);
+            if (Argument *Arg = dyn_cast<Argument>(Count))
+                SW.CountParam = Arg->getArgNo();
+            ConstantInt *C = dyn_cast<ConstantInt>(Count);
+            SW.Single = C && C->isOne();
+        }
+        Value *Req = CI->getArgOperand(Spec->Request);
+        if (Argument *Arg = dyn_cast<Argument>(Req->stripPointerCasts())) {
+            SW.RequestParam = Arg->getArgNo();
+            S.Completed.push_back(SW);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/// Use the combined summaries of the functions this module declares,
+/// keeping the accesses to globals it can refer to
+void SummaryEngine::importSummaries(void) {
+    if (!Imports)
+        return;
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        Function *F = &*f;
+        if (!F->isDeclaration() || classifyMPIAPI(F->getName()) != NotMPIAPI)
+            continue;
+        const CallSummary *Imported = Imports->lookup(F->getName());
+        if (!Imported)
+            continue;
+        auto IsKnown = [this](const SummaryAccess &A) {
+            return A.Param >= 0 || M->getNamedGlobal(A.Global);
+        };
+        CallSummary S;
+        for (const SummaryAccess &A : Imported->Accesses) {
+            if (IsKnown(A))
+                S.Accesses.push_back(A);
+        }
+        for (const SummaryRequest &R : Imported->Started) {
+            if (IsKnown(R.Buffer))
+                S.Started.push_back(R);
+        }
+        S.Completed = Imported->Completed;
+        if (!S.empty())
+            Summaries[F] = move(S);
+    }
+}
+
+/// Summarize the loads, stores and calls of a function
+void SummaryEngine::summarizeFunction(const DataLayout &DL, Function *F,
+                                      CallSummary &S) {
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt) {
+        for (BasicBlock::iterator it = bt->begin(), ie = bt->end();
+             it != ie; ++it) {
+            Instruction *I = &*it;
+            if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+                addAccess(DL, S, LI->getPointerOperand(),
+                          getAccessSizeFromPointerType(
+                              LI->getPointerOperandType()), false);
+                continue;
+            }
+            if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+                addAccess(DL, S, SI->getPointerOperand(),
+                          getAccessSizeFromPointerType(
+                              SI->getPointerOperandType()), true);
+                continue;
+            }
+            CallBase *CI = dyn_cast<CallBase>(I);
+            if (!CI)
+                continue;
+            Function *Callee = CI->getCalledFunction();
+            if (!Callee || Callee->isIntrinsic())
+                continue;
+            StringRef Name = Callee->getName();
+            if (classifyMPIAPI(Name) != NotMPIAPI) {
+                addMPICall(DL, S, CI, Name);
+                continue;
+            }
+
+            // Callees in the same component are read as of the last round
+            DenseMap<Function *, CallSummary>::const_iterator sit =
+                Summaries.find(Callee);
+            bool External = Callee->isDeclaration() && !Callee->hasLocalLinkage();
+            if (sit == Summaries.end() && !External)
+                continue;
+            SmallVector<SummaryOperand, 4> Ops;
+            getCallOperands(DL, CI, Ops);
+            if (sit != Summaries.end()) {
+                S.addCall(Ops, sit->second);
+                continue;
+            }
+            // Only calls passing memory or requests of the caller matter
+            bool Relevant = false;
+            for (const SummaryOperand &Op : Ops)
+                Relevant |= Op.Located || Op.Param >= 0;
+            if (Relevant) {
+                SummaryCall C;
+                C.Callee = Name;
+                C.Operands.append(Ops.begin(), Ops.end());
+                S.ExternalCalls.push_back(C);
+            }
+        }
+    }
+    S.normalize();
+}
+
+void SummaryEngine::summarizeSCC(SCCInfo &SCC) {
+    // Diagnostics are printed by the analysis of each function
+    raw_null_ostream NullOS;
+    raw_ostream *PrevOS = setOutputStream(&NullOS);
+    // Struct layouts are computed lazily, so each task has its own layout
+    DataLayout DL(M->getDataLayout());
+    for (unsigned Round = 0; Round < MaxSCCIterations; ++Round) {
+        bool Changed = false;
+        for (Function *F : SCC.Funcs) {
+            CallSummary S;
+            summarizeFunction(DL, F, S);
+            CallSummary &Old = Summaries.find(F)->second;
+            if (S != Old) {
+                Old = move(S);
+                Changed = true;
+            }
+        }
+        if (!SCC.Recursive || !Changed)
+            break;
+    }
+    setOutputStream(PrevOS);
+}
+
+void SummaryEngine::run(void) {
+    PhaseTimer PT(SummaryPhase, M->getModuleIdentifier());
+    importSummaries();
+
+    CallGraph CG(*M);
+    DenseMap<Function *, unsigned> SCCIds;
+    unsigned NumLevels = 0;
+    unsigned NumSummarized = 0;
+    for (scc_iterator<CallGraph *> it = scc_begin(&CG); !it.isAtEnd(); ++it) {
+        SCCInfo Info;
+        Info.Recursive = it.hasCycle();
+        Info.Level = 0;
+        const vector<CallGraphNode *> &Nodes = *it;
+        for (CallGraphNode *N : Nodes) {
+            Function *F = N->getFunction();
+            if (F && !F->isDeclaration())
+                Info.Funcs.push_back(F);
+        }
+        if (Info.Funcs.empty())
+            continue;
+
+        // Callee components come first
+        unsigned Id = SCCs.size();
+        for (CallGraphNode *N : Nodes) {
+            for (CallGraphNode::iterator cit = N->begin(), ce = N->end();
+                 cit != ce; ++cit) {
+                DenseMap<Function *, unsigned>::iterator sit =
+                    SCCIds.find(cit->second->getFunction());
+                if (sit != SCCIds.end())
+                    Info.Level = max(Info.Level, SCCs[sit->second].Level + 1);
+            }
+        }
+        for (Function *F : Info.Funcs) {
+            SCCIds[F] = Id;
+            Summaries[F];
+        }
+        NumSummarized += Info.Funcs.size();
+        NumLevels = max(NumLevels, Info.Level + 1);
+        SCCs.push_back(move(Info));
+    }
+    addCounter(SummarizedFunctionsCounter, NumSummarized);
+
+    vector<vector<unsigned>> Levels(NumLevels);
+    for (unsigned i = 0; i < SCCs.size(); ++i)
+        Levels[SCCs[i].Level].push_back(i);
+    for (vector<unsigned> &Level : Levels) {
+        if (!Pool || Level.size() < 2) {
+            for (unsigned Id : Level)
+                summarizeSCC(SCCs[Id]);
+            continue;
+        }
+        TaskGroup TG;
+        for (unsigned Id : Level) {
+            SCCInfo *SCC = &SCCs[Id];
+            Pool->async(TG, [this, SCC]() { summarizeSCC(*SCC); });
+        }
+        Pool->wait(TG);
+    }
+}
+
+const CallSummary *SummaryEngine::getSummary(Function *F) const {
+    DenseMap<Function *, CallSummary>::const_iterator it =
+        Summaries.find(F);
+    if (it == Summaries.end() || it->second.empty())
+        return NULL;
+    return &it->second;
+}
+
+const CallSummary *SummaryEngine::getDefinedSummary(Function *F) const {
+    DenseMap<Function *, CallSummary>::const_iterator it =
+        Summaries.find(F);
+    return it == Summaries.end() ? NULL : &it->second;
+}
+
+string SummaryEngine::getCalleeSummaries(Function *F) const {
+    SetVector<Function *> Callees;
+    for (Function::iterator bt = F->begin(), be = F->end(); bt != be; ++bt) {
+        for (BasicBlock::iterator it = bt->begin(), ie = bt->end();
+             it != ie; ++it) {
+            if (CallBase *CI = dyn_cast<CallBase>(&*it))
+                if (Function *Callee = CI->getCalledFunction())
+                    Callees.insert(Callee);
+        }
+    }
+
+    string Text;
+    raw_string_ostream OS(Text);
+    for (Function *Callee : Callees) {
+        if (const CallSummary *S = getSummary(Callee)) {
+            OS << "summary " << Callee->getName() << "\n";
+            S->print(OS);
+        }
+    }
+    return OS.str();
+}
@@ -0,0 +1,189 @@
+#ifndef _SUMMARY_H_
+#define _SUMMARY_H_
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+#include "bufferoverlap.h"
+#include "common.h"
+
+class CombinedSummaryIndex;
+class WorkStealingPool;
+
+/// Bytes a function may access through one of its parameters or a global
+/// variable, e.g., [Offset, Offset + Size) from the pointer passed as
+/// the parameter. Summaries do not refer to the IR of the function, so
+/// that they can be written to summary files and combined across modules.
+struct SummaryAccess {
+    // Parameter number, or -1 if accessed through the global
+    int Param;
+    StringRef Global;
+    int64_t Offset;
+    // As in BufferAccess
+    uint64_t Size;
+    bool IsWrite;
+    bool IsElement;
+
+    bool operator==(const SummaryAccess &) const;
+
+    /// Locate the access at a call of the function
+    void locate(CallBase *, const DataLayout &, BufferAccess &) const;
+};
+
+/// A request the function starts on a request parameter and leaves
+/// outstanding when it returns, along with the buffer of the request
+struct SummaryRequest {
+    unsigned RequestParam;
+    SummaryAccess Buffer;
+
+    bool operator==(const SummaryRequest &) const;
+};
+
+/// Requests passed as a parameter that the function completes
+struct SummaryWait {
+    unsigned RequestParam;
+    // Parameter holding the number of requests, or -1 if the number is
+    // not a parameter, in which case Single tells whether it is one
+    int CountParam;
+    bool Single;
+
+    bool operator==(const SummaryWait &) const;
+};
+
+/// Operand of a call, relative to the caller
+struct SummaryOperand {
+    // The operand is a pointer located at Loc
+    bool Located;
+    SummaryAccess Loc;
+    // Parameter passed as the operand, -1 if none
+    int Param;
+    // The operand is the constant 1, e.g., a number of requests
+    bool IsOne;
+
+    bool operator==(const SummaryOperand &) const;
+};
+
+/// A call to a function defined outside the module, resolved when the
+/// summaries of several modules are combined
+struct SummaryCall {
+    StringRef Callee;
+    SmallVector<SummaryOperand, 4> Operands;
+
+    bool operator==(const SummaryCall &) const;
+};
+
+/// What a call of a function does to the memory and the requests of its
+/// caller, so that the call can be checked without walking the callee
+struct CallSummary {
+    // Sorted, without duplicates
+    SmallVector<SummaryAccess, 4> Accesses;
+    SmallVector<SummaryRequest, 1> Started;
+    SmallVector<SummaryWait, 1> Completed;
+    // Calls to functions of other modules, including those of the callees
+    // in the module
+    SmallVector<SummaryCall, 2> ExternalCalls;
+
+    /// Check whether a call of the function has no effect on its caller
+    /// as far as this module knows
+    bool empty(void) const {
+        return Accesses.empty() && Started.empty() && Completed.empty();
+    }
+
+    bool operator==(const CallSummary &) const;
+
+    bool operator!=(const CallSummary &S) const {
+        return !(*this == S);
+    }
+
+    /// The MPI call a call of the function acts as: a nonblocking call if
+    /// it starts exactly one request, a wait call if it completes exactly
+    /// one, and NotMPIAPI otherwise
+    MPIAPIKind getKind(void) const;
+
+    /// Check whether a call of the function may access memory, or only
+    /// write it
+    bool mayAccess(bool WritesOnly) const;
+
+    /// Locate the accesses of a call of the function
+    void getCallAccesses(CallBase *, const DataLayout &,
+                         SmallVectorImpl<BufferAccess> &) const;
+
+    /// Add the effects of a call with the given operands to a function
+    /// with the summary Callee
+    void addCall(ArrayRef<SummaryOperand>, const CallSummary &Callee);
+
+    /// Sort the accesses and drop duplicates, widening them to whole
+    /// objects if there are too many, and drop the requests that are both
+    /// started and completed
+    void normalize(void);
+
+    void print(raw_ostream &) const;
+};
+
+/// Summaries of the functions of a module, computed bottom-up over the
+/// strongly connected components of the call graph. Components whose
+/// callees are all summarized are independent and summarized in parallel.
+/// Recursive components are iterated until their summaries stop changing.
+/// Only direct calls are followed; indirect calls are opaque as before.
+/// Calls to functions of other modules use the imported summaries if any.
+class SummaryEngine {
+private:
+    struct SCCInfo {
+        vector<Function *> Funcs;
+        bool Recursive;
+        // Longest chain of components below this one
+        unsigned Level;
+    };
+
+    Module *M;
+    WorkStealingPool *Pool;
+    const CombinedSummaryIndex *Imports;
+
+    // One entry per defined function and imported declaration, created
+    // before summarizing so that concurrent tasks never insert
+    DenseMap<Function *, CallSummary> Summaries;
+    // Components in bottom-up order
+    vector<SCCInfo> SCCs;
+
+    bool getSummaryLocation(const DataLayout &, Value *Ptr, uint64_t Size,
+                            bool IsWrite, SummaryAccess &);
+
+    void getCallOperands(const DataLayout &, CallBase *,
+                         SmallVectorImpl<SummaryOperand> &);
+
+    void addAccess(const DataLayout &, CallSummary &, Value *Ptr,
+                   uint64_t Size, bool IsWrite);
+
+    void addMPICall(const DataLayout &, CallSummary &, CallBase *,
+                    StringRef);
+
+    void importSummaries(void);
+
+    void summarizeFunction(const DataLayout &, Function *, CallSummary &);
+
+    void summarizeSCC(SCCInfo &);
+
+public:
+    SummaryEngine(Module *, WorkStealingPool *,
+                  const CombinedSummaryIndex *Imports = NULL);
+
+    void run(void);
+
+    /// Get the summary of a function, NULL if it has no effect on its
+    /// callers or is neither defined in the module nor imported
+    const CallSummary *getSummary(Function *) const;
+
+    /// Get the summary of a defined function even if it has no effect,
+    /// e.g., to export it
+    const CallSummary *getDefinedSummary(Function *) const;
+
+    /// Print the summaries of the callees of a function, which its report
+    /// depends on
+    string getCalleeSummaries(Function *) const;
+};
+
+#endif
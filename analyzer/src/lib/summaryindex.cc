@@ -0,0 +1,356 @@
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+
+#include "summaryindex.h"
+
+// Summary files start with the magic and the version. Bump the version
+// when the layout below changes.
+static const char SummaryMagic[4] = {'M', 'P', 'I', 'S'};
+static const uint32_t SummaryVersion = 1;
+// Rounds of resolving the calls between modules before giving up on a
+// fixed point, e.g., for recursion across modules
+static const unsigned MaxCombineRounds = 16;
+
+/// Little-endian encoding of the summaries. Strings are a length followed
+/// by the bytes.
+class SummaryFileWriter {
+private:
+    support::endian::Writer W;
+    Module *M;
+
+public:
+    SummaryFileWriter(raw_ostream &OS, Module *M_)
+        : W(OS, support::little), M(M_) {}
+
+    void writeString(StringRef S) {
+        W.write<uint32_t>(S.size());
+        W.OS << S;
+    }
+
+    /// Check whether other modules can refer to the memory accessed.
+    /// Globals local to the module cannot be named outside of it.
+    bool isExported(const SummaryAccess &A) {
+        if (A.Param >= 0)
+            return true;
+        GlobalVariable *GV = M->getNamedGlobal(A.Global);
+        return GV && !GV->hasLocalLinkage();
+    }
+
+    void writeAccess(const SummaryAccess &A) {
+        W.write<int32_t>(A.Param);
+        writeString(A.Global);
+        W.write<int64_t>(A.Offset);
+        W.write<uint64_t>(A.Size);
+        W.write<uint8_t>((A.IsWrite ? 1 : 0) | (A.IsElement ? 2 : 0));
+    }
+
+    void writeSummary(const CallSummary &S) {
+        SmallVector<const SummaryAccess *, 4> Accesses;
+        for (const SummaryAccess &A : S.Accesses) {
+            if (isExported(A))
+                Accesses.push_back(&A);
+        }
+        W.write<uint32_t>(Accesses.size());
+        for (const SummaryAccess *A : Accesses)
+            writeAccess(*A);
+
+        SmallVector<const SummaryRequest *, 1> Started;
+        for (const SummaryRequest &R : S.Started) {
+            if (isExported(R.Buffer))
+                Started.push_back(&R);
+        }
+        W.write<uint32_t>(Started.size());
+        for (const SummaryRequest *R : Started) {
+            W.write<uint32_t>(R->RequestParam);
+            writeAccess(R->Buffer);
+        }
+
+        W.write<uint32_t>(S.Completed.size());
+        for (const SummaryWait &SW : S.Completed) {
+            W.write<uint32_t>(SW.RequestParam);
+            W.write<int32_t>(SW.CountParam);
+            W.write<uint8_t>(SW.Single);
+        }
+
+        W.write<uint32_t>(S.ExternalCalls.size());
+        for (const SummaryCall &C : S.ExternalCalls) {
+            writeString(C.Callee);
+            W.write<uint32_t>(C.Operands.size());
+            for (const SummaryOperand &Op : C.Operands) {
+                bool Located = Op.Located && isExported(Op.Loc);
+                W.write<uint8_t>((Located ? 1 : 0) | (Op.IsOne ? 2 : 0));
+                W.write<int32_t>(Op.Param);
+                if (Located)
+                    writeAccess(Op.Loc);
+            }
+        }
+    }
+};
+
+bool writeModuleSummary(StringRef File, Module *M,
+                        const SummaryEngine &Summaries) {
+    error_code EC;
+    raw_fd_ostream OS(File, EC, sys::fs::OF_None);
+    if (EC)
+        return false;
+
+    // The combine stage reloads the module from here
+    SmallString<256> Path(M->getModuleIdentifier());
+    sys::fs::make_absolute(Path);
+
+    SummaryFileWriter SW(OS, M);
+    OS.write(SummaryMagic, sizeof(SummaryMagic));
+    support::endian::write<uint32_t>(OS, SummaryVersion, support::little);
+    SW.writeString(Path);
+
+    // Functions other modules may call, and those whose reports may
+    // depend on other modules
+    struct Record {
+        Function *F;
+        unsigned NumNonblocking;
+        SetVector<StringRef> Callees;
+    };
+    vector<Record> Records;
+    for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+        Function *F = &*f;
+        if (F->isDeclaration())
+            continue;
+        Record R;
+        R.F = F;
+        R.NumNonblocking = 0;
+        for (Function::iterator bt = F->begin(), be = F->end(); bt != be;
+             ++bt) {
+            for (BasicBlock::iterator it = bt->begin(), ie = bt->end();
+                 it != ie; ++it) {
+                CallBase *CI = dyn_cast<CallBase>(&*it);
+                Function *Callee = CI ? CI->getCalledFunction() : NULL;
+                if (!Callee || Callee->isIntrinsic())
+                    continue;
+                MPIAPIKind Kind = classifyMPIAPI(Callee->getName());
+                if (Kind == MPINonblockingAPI)
+                    ++R.NumNonblocking;
+                else if (Kind == NotMPIAPI && Callee->isDeclaration())
+                    R.Callees.insert(Callee->getName());
+            }
+        }
+        if (!F->hasLocalLinkage() || R.NumNonblocking || !R.Callees.empty())
+            Records.push_back(move(R));
+    }
+
+    support::endian::write<uint32_t>(OS, Records.size(), support::little);
+    for (Record &R : Records) {
+        SW.writeString(R.F->getName());
+        support::endian::write<uint8_t>(OS, !R.F->hasLocalLinkage(),
+                                        support::little);
+        support::endian::write<uint32_t>(OS, R.NumNonblocking,
+                                         support::little);
+        support::endian::write<uint32_t>(OS, R.Callees.size(),
+                                         support::little);
+        for (StringRef Callee : R.Callees)
+            SW.writeString(Callee);
+        SW.writeSummary(*Summaries.getDefinedSummary(R.F));
+    }
+    return !OS.has_error();
+}
+
+/// Decoder of a summary file in memory. Reads past the end set Failed
+/// instead of reading out of bounds.
+class SummaryFileReader {
+private:
+    const char *Cur;
+    const char *End;
+
+public:
+    bool Failed;
+
+    SummaryFileReader(StringRef Data)
+        : Cur(Data.begin()), End(Data.end()), Failed(false) {}
+
+    template <typename T> T read(void) {
+        if (Failed || (size_t)(End - Cur) < sizeof(T)) {
+            Failed = true;
+            return T();
+        }
+        T V = support::endian::read<T, support::little, support::unaligned>(
+            Cur);
+        Cur += sizeof(T);
+        return V;
+    }
+
+    StringRef readString(void) {
+        uint32_t Len = read<uint32_t>();
+        if (Failed || (size_t)(End - Cur) < Len) {
+            Failed = true;
+            return "";
+        }
+        StringRef S(Cur, Len);
+        Cur += Len;
+        return S;
+    }
+
+    /// Read a count of records, each at least MinSize bytes long, so
+    /// that a corrupt count does not reserve huge vectors
+    uint32_t readCount(size_t MinSize) {
+        uint32_t N = read<uint32_t>();
+        if ((size_t)(End - Cur) / MinSize < N)
+            Failed = true;
+        return Failed ? 0 : N;
+    }
+
+    void readAccess(SummaryAccess &A) {
+        A.Param = read<int32_t>();
+        A.Global = readString();
+        A.Offset = read<int64_t>();
+        A.Size = read<uint64_t>();
+        uint8_t Flags = read<uint8_t>();
+        A.IsWrite = Flags & 1;
+        A.IsElement = Flags & 2;
+    }
+
+    void readSummary(CallSummary &S) {
+        S.Accesses.resize(readCount(25));
+        for (SummaryAccess &A : S.Accesses)
+            readAccess(A);
+
+        S.Started.resize(readCount(29));
+        for (SummaryRequest &R : S.Started) {
+            R.RequestParam = read<uint32_t>();
+            readAccess(R.Buffer);
+        }
+
+        S.Completed.resize(readCount(9));
+        for (SummaryWait &W : S.Completed) {
+            W.RequestParam = read<uint32_t>();
+            W.CountParam = read<int32_t>();
+            W.Single = read<uint8_t>();
+        }
+
+        S.ExternalCalls.resize(readCount(8));
+        for (SummaryCall &C : S.ExternalCalls) {
+            C.Callee = readString();
+            C.Operands.resize(readCount(5));
+            for (SummaryOperand &Op : C.Operands) {
+                uint8_t Flags = read<uint8_t>();
+                Op.Located = Flags & 1;
+                Op.IsOne = Flags & 2;
+                Op.Param = read<int32_t>();
+                if (Op.Located)
+                    readAccess(Op.Loc);
+            }
+        }
+    }
+};
+
+bool CombinedSummaryIndex::addFile(StringRef File, string &Error) {
+    // Summaries refer to the strings of the file, so it stays mapped
+    ErrorOr<unique_ptr<MemoryBuffer>> BufOrErr = MemoryBuffer::getFile(
+        File, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!BufOrErr) {
+        Error = BufOrErr.getError().message();
+        return false;
+    }
+    StringRef Data = (*BufOrErr)->getBuffer();
+    if (!Data.startswith(StringRef(SummaryMagic, sizeof(SummaryMagic)))) {
+        Error = "not a summary file";
+        return false;
+    }
+
+    SummaryFileReader R(Data.drop_front(sizeof(SummaryMagic)));
+    if (R.read<uint32_t>() != SummaryVersion) {
+        Error = "unsupported summary file version";
+        return false;
+    }
+    ModuleEntry ME;
+    ME.Path = R.readString();
+    ME.Functions.resize(R.readCount(13));
+    for (FunctionEntry &FE : ME.Functions) {
+        FE.Name = R.readString();
+        FE.Exported = R.read<uint8_t>();
+        FE.NumNonblocking = R.read<uint32_t>();
+        FE.Callees.resize(R.readCount(4));
+        for (StringRef &Callee : FE.Callees)
+            Callee = R.readString();
+        R.readSummary(FE.Summary);
+    }
+    if (R.Failed) {
+        Error = "truncated summary file";
+        return false;
+    }
+
+    Buffers.push_back(move(*BufOrErr));
+    Modules.push_back(move(ME));
+    return true;
+}
+
+void CombinedSummaryIndex::combine(void) {
+    // The first module exporting a function defines it, as the linker
+    // would pick one of several weak definitions
+    vector<const FunctionEntry *> Defs;
+    for (const ModuleEntry &ME : Modules) {
+        for (const FunctionEntry &FE : ME.Functions) {
+            if (!FE.Exported || Combined.count(FE.Name))
+                continue;
+            CallSummary &S = Combined[FE.Name];
+            S = FE.Summary;
+            S.ExternalCalls.clear();
+            Defs.push_back(&FE);
+        }
+    }
+
+    for (unsigned Round = 0; Round < MaxCombineRounds; ++Round) {
+        bool Changed = false;
+        for (const FunctionEntry *FE : Defs) {
+            CallSummary S = FE->Summary;
+            S.ExternalCalls.clear();
+            for (const SummaryCall &C : FE->Summary.ExternalCalls) {
+                StringMap<CallSummary>::const_iterator it =
+                    Combined.find(C.Callee);
+                if (it != Combined.end())
+                    S.addCall(C.Operands, it->second);
+            }
+            S.normalize();
+            CallSummary &Old = Combined[FE->Name];
+            if (S != Old) {
+                Old = move(S);
+                Changed = true;
+            }
+        }
+        if (!Changed)
+            break;
+    }
+}
+
+const CallSummary *CombinedSummaryIndex::lookup(StringRef Name) const {
+    StringMap<CallSummary>::const_iterator it = Combined.find(Name);
+    if (it == Combined.end() || it->second.empty())
+        return NULL;
+    return &it->second;
+}
+
+/// Check whether the reports of a module may change with the summaries
+/// of other modules: a call to another module may access the buffer of a
+/// nonblocking call of the module, or be a nonblocking call itself
+bool CombinedSummaryIndex::dependsOnImports(const ModuleEntry &ME) const {
+    bool HasNonblocking = false;
+    for (const FunctionEntry &FE : ME.Functions)
+        HasNonblocking |= FE.NumNonblocking > 0;
+    for (const FunctionEntry &FE : ME.Functions) {
+        for (StringRef Callee : FE.Callees) {
+            const CallSummary *S = lookup(Callee);
+            if (S && (HasNonblocking || !S->Started.empty()))
+                return true;
+        }
+    }
+    return false;
+}
+
+void CombinedSummaryIndex::getDependentModules(vector<string> &Paths) const {
+    for (const ModuleEntry &ME : Modules) {
+        if (dependsOnImports(ME))
+            Paths.push_back(ME.Path.str());
+    }
+}
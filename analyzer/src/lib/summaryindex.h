@@ -0,0 +1,70 @@
+#ifndef _SUMMARYINDEX_H_
+#define _SUMMARYINDEX_H_
+
+#include <memory>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "summary.h"
+
+/// Write the summaries of a module to a summary file, the first stage of
+/// a two-stage run. The file records the functions other modules may call
+/// and the external functions each function calls, so that the combine
+/// stage only reloads the modules whose reports may change.
+bool writeModuleSummary(StringRef File, Module *, const SummaryEngine &);
+
+/// Summaries of the exported functions of several modules, read from
+/// their summary files and combined across the modules. Summary files are
+/// mapped into memory and the summaries refer to the names in them.
+class CombinedSummaryIndex {
+private:
+    struct FunctionEntry {
+        StringRef Name;
+        bool Exported;
+        // Nonblocking MPI calls in the function
+        unsigned NumNonblocking;
+        // External functions the function calls
+        SmallVector<StringRef, 4> Callees;
+        CallSummary Summary;
+    };
+
+    struct ModuleEntry {
+        StringRef Path;
+        vector<FunctionEntry> Functions;
+    };
+
+    vector<unique_ptr<MemoryBuffer>> Buffers;
+    vector<ModuleEntry> Modules;
+    // Combined summaries of the exported functions, without calls to
+    // other modules
+    StringMap<CallSummary> Combined;
+
+    bool dependsOnImports(const ModuleEntry &) const;
+
+public:
+    /// Read a summary file, setting Error if it is not one
+    bool addFile(StringRef File, string &Error);
+
+    /// Resolve the calls between the modules until the summaries stop
+    /// changing
+    void combine(void);
+
+    /// Get the combined summary of an exported function, NULL if no
+    /// module exports it or it has no effect on its callers
+    const CallSummary *lookup(StringRef Name) const;
+
+    /// Get the modules with nonblocking calls that call functions of
+    /// other modules with a non-empty summary, in the order of the files
+    void getDependentModules(vector<string> &Paths) const;
+
+    unsigned getNumModules(void) const {
+        return Modules.size();
+    }
+
+    unsigned getNumSummaries(void) const {
+        return Combined.size();
+    }
+};
+
+#endif
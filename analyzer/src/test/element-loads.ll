@@ -0,0 +1,47 @@
+; Elements of a buffer reached through different loads of the same pointer
+; variable, as at -O0:
+;
+;   MPI_Irecv(&buf[1], 1, MPI_DOUBLE, ...);
+;   buf[1] = 3.0;   // races with the receive
+;   buf[2] = 3.0;   // does not
+;   MPI_Wait(...);
+
+declare i8* @malloc(i64)
+declare i32 @MPI_Irecv(i8*, i32, i32, i32, i32, i32, i32*)
+declare i32 @MPI_Wait(i32*, i8*)
+
+define void @same_element() {
+entry:
+  %m = call i8* @malloc(i64 64)
+  %buf = bitcast i8* %m to double*
+  %buf.addr = alloca double*
+  %req = alloca i32
+  store double* %buf, double** %buf.addr
+  %l0 = load double*, double** %buf.addr
+  %recv = getelementptr inbounds double, double* %l0, i64 1
+  %recv.c = bitcast double* %recv to i8*
+  %r = call i32 @MPI_Irecv(i8* %recv.c, i32 1, i32 1275070475, i32 0, i32 0, i32 0, i32* %req)
+  %l1 = load double*, double** %buf.addr
+  %racy = getelementptr inbounds double, double* %l1, i64 1
+  store double 3.0, double* %racy
+  %w = call i32 @MPI_Wait(i32* %req, i8* null)
+  ret void
+}
+
+define void @other_element() {
+entry:
+  %m = call i8* @malloc(i64 64)
+  %buf = bitcast i8* %m to double*
+  %buf.addr = alloca double*
+  %req = alloca i32
+  store double* %buf, double** %buf.addr
+  %l0 = load double*, double** %buf.addr
+  %recv = getelementptr inbounds double, double* %l0, i64 1
+  %recv.c = bitcast double* %recv to i8*
+  %r = call i32 @MPI_Irecv(i8* %recv.c, i32 1, i32 1275070475, i32 0, i32 0, i32 0, i32* %req)
+  %l1 = load double*, double** %buf.addr
+  %safe = getelementptr inbounds double, double* %l1, i64 2
+  store double 3.0, double* %safe
+  %w = call i32 @MPI_Wait(i32* %req, i8* null)
+  ret void
+}